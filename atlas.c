@@ -0,0 +1,255 @@
+/*
+ * Copyright (c) 2010, Bertrand Janin <tamentis@neopulsar.org>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cairo.h>
+
+#include "chartesque.h"
+
+static pthread_mutex_t	 atlas_lock = PTHREAD_MUTEX_INITIALIZER;
+static chq_atlas_t	*atlas_list = NULL;
+static unsigned int	 atlas_generation = 0;
+
+
+/**
+ * Rasterize every atlas character once into its own A8 mask, with a pixel
+ * of margin for the antialiasing. The mask is meant to be placed at the pen
+ * position plus (mask_x, mask_y).
+ * @private
+ */
+static void
+chq_atlas_render(chq_atlas_t *atlas)
+{
+	cairo_surface_t *scratch;
+	cairo_text_extents_t extents;
+	chq_glyph_t *glyph;
+	cairo_t *cr, *glyph_cr;
+	char text[2] = { 0, 0 };
+	size_t i;
+	int width, height;
+
+	scratch = cairo_image_surface_create(CAIRO_FORMAT_A8, 1, 1);
+	cr = cairo_create(scratch);
+	cairo_select_font_face(cr, atlas->fontfamily, atlas->slant,
+			atlas->weight);
+	cairo_set_font_size(cr, atlas->fontsize);
+
+	for (i = 0; i < CHQ_ATLAS_CHARS_LEN; i++) {
+		glyph = &atlas->glyphs[i];
+		text[0] = CHQ_ATLAS_CHARS[i];
+
+		cairo_text_extents(cr, text, &extents);
+		glyph->x_bearing = extents.x_bearing;
+		glyph->width = extents.width;
+		glyph->height = extents.height;
+		glyph->x_advance = extents.x_advance;
+		glyph->mask_x = (int)floor(extents.x_bearing) - 1;
+		glyph->mask_y = (int)floor(extents.y_bearing) - 1;
+
+		width = (int)ceil(extents.x_bearing + extents.width) -
+			glyph->mask_x + 1;
+		height = (int)ceil(extents.y_bearing + extents.height) -
+			glyph->mask_y + 1;
+		glyph->mask = cairo_image_surface_create(CAIRO_FORMAT_A8,
+				width > 0 ? width : 1, height > 0 ? height : 1);
+
+		glyph_cr = cairo_create(glyph->mask);
+		cairo_select_font_face(glyph_cr, atlas->fontfamily,
+				atlas->slant, atlas->weight);
+		cairo_set_font_size(glyph_cr, atlas->fontsize);
+		cairo_move_to(glyph_cr, -glyph->mask_x, -glyph->mask_y);
+		cairo_show_text(glyph_cr, text);
+		cairo_destroy(glyph_cr);
+		cairo_surface_flush(glyph->mask);
+	}
+
+	cairo_destroy(cr);
+	cairo_surface_destroy(scratch);
+}
+
+
+/**
+ * Return true if the atlas was rendered for this exact font.
+ */
+int
+chq_atlas_matches(chq_atlas_t *atlas, const char *family,
+		cairo_font_slant_t slant, cairo_font_weight_t weight,
+		double size)
+{
+	return atlas->slant == slant && atlas->weight == weight &&
+		atlas->fontsize == size &&
+		strcmp(atlas->fontfamily, family) == 0;
+}
+
+
+/**
+ * Return the shared atlas of a font, rendering it the first time it is
+ * asked for. Safe to call from any thread.
+ */
+chq_atlas_t *
+chq_atlas_get(const char *family, cairo_font_slant_t slant,
+		cairo_font_weight_t weight, double size)
+{
+	chq_atlas_t *atlas;
+
+	pthread_mutex_lock(&atlas_lock);
+
+	for (atlas = atlas_list; atlas != NULL; atlas = atlas->next) {
+		if (chq_atlas_matches(atlas, family, slant, weight, size))
+			break;
+	}
+
+	if (atlas == NULL) {
+		atlas = calloc(1, sizeof(chq_atlas_t));
+		atlas->fontfamily = strdup(family);
+		atlas->slant = slant;
+		atlas->weight = weight;
+		atlas->fontsize = size;
+		chq_atlas_render(atlas);
+		atlas->next = atlas_list;
+		atlas_list = atlas;
+	}
+
+	pthread_mutex_unlock(&atlas_lock);
+
+	return atlas;
+}
+
+
+/**
+ * Return the number of times the atlases were freed, an atlas obtained
+ * before the count changed must not be used anymore.
+ */
+unsigned int
+chq_atlas_generation(void)
+{
+	unsigned int generation;
+
+	pthread_mutex_lock(&atlas_lock);
+	generation = atlas_generation;
+	pthread_mutex_unlock(&atlas_lock);
+
+	return generation;
+}
+
+
+/**
+ * Return the glyph of a character, NULL if it is not in the atlas.
+ * @private
+ */
+static chq_glyph_t *
+chq_atlas_find_glyph(chq_atlas_t *atlas, char c)
+{
+	const char *found;
+
+	if (c == '\0')
+		return NULL;
+
+	found = strchr(CHQ_ATLAS_CHARS, c);
+	if (found == NULL)
+		return NULL;
+
+	return &atlas->glyphs[found - CHQ_ATLAS_CHARS];
+}
+
+
+/**
+ * Set the ink width and height of a label the way cairo_text_extents()
+ * would. Returns -1 if the label has characters missing from the atlas, it
+ * then has to go through cairo.
+ */
+int
+chq_atlas_measure(chq_atlas_t *atlas, const char *text, double *width,
+		double *height)
+{
+	chq_glyph_t *glyph;
+	double pen = 0.0, left = 0.0, right = 0.0, max_height = 0.0;
+	const char *c;
+
+	for (c = text; *c != '\0'; c++) {
+		glyph = chq_atlas_find_glyph(atlas, *c);
+		if (glyph == NULL)
+			return -1;
+
+		if (c == text)
+			left = pen + glyph->x_bearing;
+		right = pen + glyph->x_bearing + glyph->width;
+		if (glyph->height > max_height)
+			max_height = glyph->height;
+		pen += glyph->x_advance;
+	}
+
+	*width = right - left;
+	*height = max_height;
+
+	return 0;
+}
+
+
+/**
+ * Paint a label with the current source of the context, the pen starting
+ * at x, y like cairo_show_text(). Every character is a single mask blit at
+ * a whole pixel position. The label must only have atlas characters.
+ */
+void
+chq_atlas_show(chq_atlas_t *atlas, cairo_t *cr, double x, double y,
+		const char *text)
+{
+	chq_glyph_t *glyph;
+	double pen = x;
+	int baseline = (int)floor(y + 0.5);
+	const char *c;
+
+	for (c = text; *c != '\0'; c++) {
+		glyph = chq_atlas_find_glyph(atlas, *c);
+		if (glyph == NULL)
+			continue;
+
+		cairo_mask_surface(cr, glyph->mask,
+				floor(pen + 0.5) + glyph->mask_x,
+				baseline + glyph->mask_y);
+		pen += glyph->x_advance;
+	}
+}
+
+
+/**
+ * Free all the atlases, no chart may be rendering anymore. Charts still
+ * alive get new atlases on their next render.
+ */
+void
+chq_atlas_cleanup(void)
+{
+	chq_atlas_t *atlas, *next;
+	size_t i;
+
+	pthread_mutex_lock(&atlas_lock);
+
+	for (atlas = atlas_list; atlas != NULL; atlas = next) {
+		next = atlas->next;
+		for (i = 0; i < CHQ_ATLAS_CHARS_LEN; i++)
+			cairo_surface_destroy(atlas->glyphs[i].mask);
+		free(atlas->fontfamily);
+		free(atlas);
+	}
+	atlas_list = NULL;
+	atlas_generation++;
+
+	pthread_mutex_unlock(&atlas_lock);
+}
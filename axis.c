@@ -44,6 +44,9 @@ chq_axis_new()
 	axis->ticks_positions = NULL;
 	axis->ticks_labels = NULL;
 
+	axis->atlas = NULL;
+	axis->atlas_generation = 0;
+
 	axis->orientation = ORIENTATION_HORIZONTAL;
 	axis->size = 0;
 
@@ -121,6 +124,17 @@ chq_axis_get_spread(chq_axis_t *axis)
 void
 chq_axis_set_size(chq_axis_t *axis, double size)
 {
+	unsigned int i;
+
+	CHQ_TRACE_BEGIN("axis_set_size", NULL);
+
+	/* Drop the ticks of a previous layout */
+	for (i = 0; i < axis->ticks_count; i++) {
+		free(axis->ticks_labels[i]);
+	}
+	free(axis->ticks_positions);
+	free(axis->ticks_labels);
+
 	axis->size = size;
 
 	switch (axis->orientation) {
@@ -135,9 +149,11 @@ chq_axis_set_size(chq_axis_t *axis, double size)
 	}
 
 	axis->ticks_positions = malloc(sizeof(double) * axis->ticks_count);
-	axis->ticks_labels = malloc(sizeof(char *) * axis->ticks_count);
+	axis->ticks_labels = calloc(axis->ticks_count, sizeof(char *));
 	axis->ticks_value_spacing = chq_axis_get_spread(axis) / 
 		(axis->ticks_count - 1);
+
+	CHQ_TRACE_END("axis_set_size");
 }
 
 
@@ -163,6 +179,30 @@ chq_axis_convert_to_scale(chq_axis_t *axis, double value)
 }
 
 
+/**
+ * Express chq_axis_convert_to_scale() as scale * value + offset, so that
+ * long series can be converted without going through a function call and a
+ * switch for every single value.
+ */
+void
+chq_axis_get_transform(chq_axis_t *axis, double *scale, double *offset)
+{
+	double spread = chq_axis_get_spread(axis);
+
+	switch (axis->orientation) {
+	case ORIENTATION_VERTICAL:
+		*scale = -axis->size / spread;
+		*offset = axis->size + axis->limit_min * axis->size / spread;
+		break;
+	case ORIENTATION_HORIZONTAL:
+	default:
+		*scale = axis->size / spread;
+		*offset = -axis->limit_min * axis->size / spread;
+		break;
+	}
+}
+
+
 /**
  * Set the label's font family on the provided cairo context.
  */
@@ -174,6 +214,29 @@ chq_axis_select_label_fontfamily(chq_axis_t *axis, cairo_t *cr)
 }
 
 
+/**
+ * Return the shared glyph atlas of the label font, looked up again whenever
+ * the font settings changed or the atlases were freed since.
+ */
+chq_atlas_t *
+chq_axis_get_atlas(chq_axis_t *axis)
+{
+	unsigned int generation = chq_atlas_generation();
+
+	if (axis->atlas == NULL || axis->atlas_generation != generation ||
+			!chq_atlas_matches(axis->atlas,
+				axis->label_fontfamily, axis->label_slant,
+				axis->label_weight, axis->label_fontsize)) {
+		axis->atlas = chq_atlas_get(axis->label_fontfamily,
+				axis->label_slant, axis->label_weight,
+				axis->label_fontsize);
+		axis->atlas_generation = generation;
+	}
+
+	return axis->atlas;
+}
+
+
 /**
  * Return the width of a vertical axis on the canvas, the result for 
  * horizontal axes is undetermined. This is the maximum size of the labels
@@ -216,7 +279,9 @@ chq_axis_prerender_value(chq_axis_t *axis, cairo_t *cr, double value,
 
 	snprintf(lbuffer, MAX_LABEL_SIZE, "%.1f", value);
 
-	if (width != NULL && height != NULL) {
+	if (width != NULL && height != NULL &&
+			chq_atlas_measure(chq_axis_get_atlas(axis), lbuffer,
+				width, height) != 0) {
 		chq_dataplot_get_text_size(cr, axis->label_fontfamily,
 				axis->label_slant, axis->label_weight,
 				axis->label_fontsize, lbuffer, width, height);
@@ -242,6 +307,8 @@ chq_axis_calculate_label_size(chq_axis_t *axis, cairo_t *cr)
 	double spacing;
 	double value;
 
+	CHQ_TRACE_BEGIN("calculate_label_size", NULL);
+
 	spacing = chq_axis_get_spread(axis) / (sample_max - 1);
 
 	for (i = 0; i < sample_max; i++) {
@@ -257,6 +324,8 @@ chq_axis_calculate_label_size(chq_axis_t *axis, cairo_t *cr)
 	/* Define label max label sizes */
 	axis->label_max_width = max_label_width;
 	axis->label_max_height = max_label_height;
+
+	CHQ_TRACE_END("calculate_label_size");
 }
 
 
@@ -267,6 +336,8 @@ chq_axis_prerender_ticks(chq_axis_t *axis, cairo_t *cr)
 	unsigned int i;
 	char *rendered;
 
+	CHQ_TRACE_BEGIN("prerender_ticks", NULL);
+
 	for (i = 0; i < axis->ticks_count; i++) {
 		value = axis->limit_min +
 			(double)i * axis->ticks_value_spacing;
@@ -277,5 +348,7 @@ chq_axis_prerender_ticks(chq_axis_t *axis, cairo_t *cr)
 				value);
 		axis->ticks_labels[i] = rendered;
 	}
+
+	CHQ_TRACE_END("prerender_ticks");
 }
 
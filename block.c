@@ -0,0 +1,403 @@
+/*
+ * Copyright (c) 2010, Bertrand Janin <tamentis@neopulsar.org>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cairo.h>
+
+#include "chartesque.h"
+
+typedef struct _chq_bit_writer_t {
+	uint8_t		*buf;
+	size_t		 len;
+	size_t		 bit;
+	int		 overflow;
+} chq_bit_writer_t;
+
+
+/**
+ * Return the IEEE 754 bits of a double and back.
+ * @private
+ */
+static uint64_t
+chq_block_double_bits(double value)
+{
+	uint64_t bits;
+
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static double
+chq_block_bits_double(uint64_t bits)
+{
+	double value;
+
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+
+/**
+ * Append the n lowest bits of value, MSB first.
+ * @private
+ */
+static void
+chq_block_put_bits(chq_bit_writer_t *writer, uint64_t value, int n)
+{
+	int i;
+
+	for (i = n - 1; i >= 0; i--) {
+		if (writer->bit / 8 >= writer->len) {
+			writer->overflow = 1;
+			return;
+		}
+		if ((value >> i) & 1)
+			writer->buf[writer->bit / 8] |= 0x80 >> (writer->bit % 8);
+		writer->bit++;
+	}
+}
+
+
+/**
+ * Read n bits (up to 64), MSB first. Running past the end of the stream
+ * marks the block as exhausted.
+ * @private
+ */
+static uint64_t
+chq_block_get_bits(chq_block_reader_t *reader, int n)
+{
+	const chq_block_t *block = reader->block;
+	uint64_t value = 0;
+	int i;
+
+	if (reader->bit + n > block->bits_len * 8) {
+		reader->remaining = 0;
+		return 0;
+	}
+
+	for (i = 0; i < n; i++, reader->bit++) {
+		value = (value << 1) |
+			((block->bits[reader->bit / 8] >> (7 - reader->bit % 8)) &
+			 1);
+	}
+
+	return value;
+}
+
+
+/**
+ * Sign-extend the n lowest bits of a value.
+ * @private
+ */
+static int64_t
+chq_block_sign_extend(uint64_t value, int n)
+{
+	uint64_t sign = (uint64_t)1 << (n - 1);
+
+	return (int64_t)((value ^ sign) - sign);
+}
+
+
+/**
+ * Compress count points into a block, the bit stream is written to buf and
+ * referenced by the block. Returns the number of bytes used, which is zero
+ * for a block of a single point (or none), or CHQ_BLOCK_ENCODE_ERROR if buf
+ * is too small.
+ */
+size_t
+chq_block_encode(chq_block_t *block, const int64_t *times,
+		const double *values, uint32_t count, uint8_t *buf,
+		size_t buf_len)
+{
+	chq_bit_writer_t writer = { buf, buf_len, 0, 0 };
+	int64_t delta, prev_delta = 0, dod;
+	uint64_t bits, prev_bits, xor;
+	int leading = -1, trailing = 0, lz, tz, len;
+	uint32_t i;
+
+	memset(block, 0, sizeof(chq_block_t));
+	memset(buf, 0, buf_len);
+	block->bits = buf;
+	block->count = count;
+	if (count == 0)
+		return 0;
+
+	block->first_time = block->min_time = block->max_time = times[0];
+	block->first_value = block->min_value = block->max_value = values[0];
+	block->last_time = times[count - 1];
+	block->last_value = values[count - 1];
+	prev_bits = chq_block_double_bits(values[0]);
+
+	for (i = 1; i < count; i++) {
+		if (times[i] < block->min_time)
+			block->min_time = times[i];
+		if (times[i] > block->max_time)
+			block->max_time = times[i];
+		if (values[i] < block->min_value)
+			block->min_value = values[i];
+		if (values[i] > block->max_value)
+			block->max_value = values[i];
+
+		delta = times[i] - times[i - 1];
+		dod = delta - prev_delta;
+		prev_delta = delta;
+
+		if (dod == 0) {
+			chq_block_put_bits(&writer, 0x0, 1);
+		} else if (dod >= -64 && dod <= 63) {
+			chq_block_put_bits(&writer, 0x2, 2);
+			chq_block_put_bits(&writer, dod, 7);
+		} else if (dod >= -256 && dod <= 255) {
+			chq_block_put_bits(&writer, 0x6, 3);
+			chq_block_put_bits(&writer, dod, 9);
+		} else if (dod >= -2048 && dod <= 2047) {
+			chq_block_put_bits(&writer, 0xe, 4);
+			chq_block_put_bits(&writer, dod, 12);
+		} else {
+			chq_block_put_bits(&writer, 0xf, 4);
+			chq_block_put_bits(&writer, dod, 64);
+		}
+
+		bits = chq_block_double_bits(values[i]);
+		xor = bits ^ prev_bits;
+		prev_bits = bits;
+
+		if (xor == 0) {
+			chq_block_put_bits(&writer, 0x0, 1);
+			continue;
+		}
+
+		lz = __builtin_clzll(xor);
+		tz = __builtin_ctzll(xor);
+		if (lz > 31)
+			lz = 31;
+
+		if (leading >= 0 && lz >= leading && tz >= trailing) {
+			chq_block_put_bits(&writer, 0x2, 2);
+			chq_block_put_bits(&writer, xor >> trailing,
+					64 - leading - trailing);
+		} else {
+			len = 64 - lz - tz;
+			chq_block_put_bits(&writer, 0x3, 2);
+			chq_block_put_bits(&writer, lz, 5);
+			chq_block_put_bits(&writer, len == 64 ? 0 : len, 6);
+			chq_block_put_bits(&writer, xor >> tz, len);
+			leading = lz;
+			trailing = tz;
+		}
+	}
+
+	if (writer.overflow)
+		return CHQ_BLOCK_ENCODE_ERROR;
+
+	block->bits_len = (writer.bit + 7) / 8;
+
+	return block->bits_len;
+}
+
+
+/**
+ * Position the reader right after the first point of a block, which is
+ * taken from the header.
+ * @private
+ */
+static void
+chq_block_reader_start(chq_block_reader_t *reader, const chq_block_t *block)
+{
+	reader->block = block;
+	reader->bit = 0;
+	reader->remaining = block->count - 1;
+	reader->time = block->first_time;
+	reader->delta = 0;
+	reader->value = chq_block_double_bits(block->first_value);
+	reader->leading = 0;
+	reader->trailing = 0;
+}
+
+
+/**
+ * Decode the next point of the block. Returns 0 once the block is done or
+ * if the stream turns out to be truncated.
+ */
+int
+chq_block_reader_next(chq_block_reader_t *reader, int64_t *time,
+		double *value)
+{
+	uint64_t bits;
+	int64_t dod;
+	int len;
+
+	if (reader->remaining == 0)
+		return 0;
+
+	if (chq_block_get_bits(reader, 1) == 0) {
+		dod = 0;
+	} else if (chq_block_get_bits(reader, 1) == 0) {
+		dod = chq_block_sign_extend(chq_block_get_bits(reader, 7), 7);
+	} else if (chq_block_get_bits(reader, 1) == 0) {
+		dod = chq_block_sign_extend(chq_block_get_bits(reader, 9), 9);
+	} else if (chq_block_get_bits(reader, 1) == 0) {
+		dod = chq_block_sign_extend(chq_block_get_bits(reader, 12),
+				12);
+	} else {
+		dod = (int64_t)chq_block_get_bits(reader, 64);
+	}
+
+	if (chq_block_get_bits(reader, 1) != 0) {
+		if (chq_block_get_bits(reader, 1) != 0) {
+			reader->leading = chq_block_get_bits(reader, 5);
+			len = chq_block_get_bits(reader, 6);
+			if (len == 0)
+				len = 64;
+			/* Corrupt, the bits don't fit: end the block */
+			if (reader->leading + len > 64) {
+				reader->remaining = 0;
+				return 0;
+			}
+			reader->trailing = 64 - reader->leading - len;
+		}
+		len = 64 - reader->leading - reader->trailing;
+		bits = chq_block_get_bits(reader, len);
+		reader->value ^= bits << reader->trailing;
+	}
+
+	/* Ran past the end of the stream */
+	if (reader->remaining == 0)
+		return 0;
+
+	reader->delta += dod;
+	reader->time += reader->delta;
+	reader->remaining--;
+
+	*time = reader->time;
+	*value = chq_block_bits_double(reader->value);
+
+	return 1;
+}
+
+
+/**
+ * Read up to max points of the chart's compressed blocks, converted to
+ * canvas coordinates. Blocks entirely outside of the x limits are not
+ * decoded, only the point nearest to the plot (from the header) is kept so
+ * the edges of the plot still go in the right direction: the last one of a
+ * block on the left, the first one of a block on the right. Blocks spanning
+ * less than a pixel are summarised by their min and max from the header.
+ * In density mode, where every point counts, the blocks outside are skipped
+ * altogether and the others are always decoded.
+ */
+size_t
+chq_block_read_points(chq_dataplot_t *chart, chq_cursor_t *cursor, double *x,
+		double *y, size_t max)
+{
+	chq_column_t unit_column;
+	const chq_block_t *block;
+	double left, top, x_scale, x_offset, y_scale, y_offset;
+	double unit, t_min, t_max;
+	int64_t time;
+	double value;
+	size_t i, count = 0;
+
+	chq_column_set(&unit_column, CHQ_DATA_INT64, chart->blocks_unit, NULL);
+	unit = chq_column_get_unit_scale(&unit_column);
+
+	chq_dataplot_get_plot_origin(chart, &left, &top);
+	chq_axis_get_transform(chart->x_axis, &x_scale, &x_offset);
+	chq_axis_get_transform(chart->y_axis, &y_scale, &y_offset);
+
+	while (count < max) {
+		if (cursor->reader.remaining > 0) {
+			if (chq_block_reader_next(&cursor->reader, &time,
+						&value)) {
+				x[count] = time * unit;
+				y[count] = value;
+				count++;
+			}
+			continue;
+		}
+
+		if (cursor->block >= chart->blocks_len)
+			break;
+
+		block = &chart->blocks[cursor->block];
+		if (block->count == 0) {
+			cursor->block++;
+			continue;
+		}
+
+		t_min = block->min_time * unit;
+		t_max = block->max_time * unit;
+
+		/* Density counts points, every one of them has to be decoded */
+		if (chart->plot_mode == CHQ_PLOT_DENSITY) {
+			if (t_max < chart->x_axis->limit_min ||
+					t_min > chart->x_axis->limit_max) {
+				cursor->block++;
+				continue;
+			}
+		} else if (t_max < chart->x_axis->limit_min) {
+			x[count] = block->last_time * unit;
+			y[count] = block->last_value;
+			count++;
+			cursor->block++;
+			continue;
+		} else if (t_min > chart->x_axis->limit_max) {
+			x[count] = block->first_time * unit;
+			y[count] = block->first_value;
+			count++;
+			cursor->block++;
+			continue;
+		}
+
+		if (chart->plot_mode != CHQ_PLOT_DENSITY && block->count > 2 &&
+				(t_max - t_min) * fabs(x_scale) < 1.0) {
+			if (count + 2 > max)
+				break;
+			x[count] = t_min;
+			y[count] = block->min_value;
+			x[count + 1] = t_max;
+			y[count + 1] = block->max_value;
+			count += 2;
+			cursor->block++;
+			continue;
+		}
+
+		x[count] = block->first_time * unit;
+		y[count] = block->first_value;
+		count++;
+		chq_block_reader_start(&cursor->reader, block);
+		cursor->block++;
+	}
+
+	if (count == 0) {
+		cursor->pos = cursor->end;
+		return 0;
+	}
+
+	x_offset += left;
+	y_offset += top;
+	for (i = 0; i < count; i++) {
+		x[i] = x[i] * x_scale + x_offset;
+		y[i] = y[i] * y_scale + y_offset;
+	}
+
+	cursor->pos += count;
+
+	return count;
+}
@@ -14,6 +14,8 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <unistd.h>
+
 #include "chartesque.h"
 
 int
@@ -35,6 +37,28 @@ main (int argc, char *argv[])
 
 	chq_dataplot_render(chart);
 
+	/* With a name, also publish a few frames for shmview */
+	if (argc > 1) {
+		chq_shm_t *shm = chq_shm_create(argv[1], 640, 280);
+		size_t i, frame;
+		double first;
+
+		if (shm == NULL)
+			return 1;
+
+		chq_dataplot_set_output_shm(chart, shm);
+		for (frame = 0; frame < 10; frame++) {
+			first = data_y[0];
+			for (i = 0; i + 1 < data_len; i++)
+				data_y[i] = data_y[i + 1];
+			data_y[data_len - 1] = first;
+			chq_dataplot_render(chart);
+			sleep(1);
+		}
+		chq_dataplot_set_output_shm(chart, NULL);
+		chq_shm_kill(shm);
+	}
+
 	chq_dataplot_kill(chart);
 
 	return 0;
@@ -19,9 +19,69 @@
 #error This program requires cairo with PNG support
 #endif
 
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 
+/*
+ * Tracing spans around the render stages, compiled out entirely unless
+ * CHQ_TRACE (Chrome trace-event JSON, see chq_trace_open) or CHQ_USDT
+ * (static probes chartesque:span_begin and span_end for perf/bpftrace) is
+ * defined.
+ */
+#ifdef CHQ_USDT
+#include <sys/sdt.h>
+#define CHQ_PROBE(event, name, detail)					\
+	DTRACE_PROBE2(chartesque, event, name, detail)
+#else
+#define CHQ_PROBE(event, name, detail)	do { } while (0)
+#endif
+
+#ifdef CHQ_TRACE
+#define CHQ_EMIT(phase, name, detail)	chq_trace_event(phase, name, detail)
+#else
+#define CHQ_EMIT(phase, name, detail)	do { } while (0)
+#endif
+
+#define CHQ_TRACE_BEGIN(name, detail) do {				\
+	CHQ_PROBE(span_begin, name, detail);				\
+	CHQ_EMIT('B', name, detail);					\
+} while (0)
+#define CHQ_TRACE_END(name) do {					\
+	CHQ_PROBE(span_end, name, NULL);				\
+	CHQ_EMIT('E', name, NULL);					\
+} while (0)
+
 #define MAX_LABEL_SIZE	64
+#define MAX_FONTFAMILY_SIZE	64
+
+/* Characters "%.1f" labels are made of, rendered once per font */
+#define CHQ_ATLAS_CHARS		"0123456789+-.e"
+#define CHQ_ATLAS_CHARS_LEN	(sizeof(CHQ_ATLAS_CHARS) - 1)
+
+typedef struct _chq_glyph_t {
+	cairo_surface_t		*mask;
+	int			 mask_x;
+	int			 mask_y;
+	double			 x_bearing;
+	double			 width;
+	double			 height;
+	double			 x_advance;
+} chq_glyph_t;
+
+/*
+ * Pre-rasterized alpha masks of the label characters for one font. Atlases
+ * are created once, shared by all the charts and threads and never modified
+ * afterwards.
+ */
+typedef struct _chq_atlas_t {
+	char			*fontfamily;
+	cairo_font_slant_t	 slant;
+	cairo_font_weight_t	 weight;
+	double			 fontsize;
+	chq_glyph_t		 glyphs[CHQ_ATLAS_CHARS_LEN];
+	struct _chq_atlas_t	*next;
+} chq_atlas_t;
 
 enum orientation {
 	ORIENTATION_HORIZONTAL = 0,
@@ -47,14 +107,252 @@ typedef struct _chq_axis_t {
 	double			*ticks_positions;
 	char			**ticks_labels;
 	double			 ticks_value_spacing;
+	/* glyphs for the current label font */
+	chq_atlas_t		*atlas;
+	unsigned int		 atlas_generation;
 } chq_axis_t;
 
+#define CHQ_CHUNK_SIZE	1024
+
+enum chq_data_type {
+	CHQ_DATA_FLOAT64 = 0,
+	CHQ_DATA_FLOAT32 = 1,
+	CHQ_DATA_INT32 = 2,
+	CHQ_DATA_INT64 = 3
+};
+
+/*
+ * Integer columns with a time unit are converted to seconds on the fly, the
+ * axis limits are then expected in seconds.
+ */
+enum chq_time_unit {
+	CHQ_TIME_NONE = 0,
+	CHQ_TIME_SECONDS = 1,
+	CHQ_TIME_MILLISECONDS = 2,
+	CHQ_TIME_MICROSECONDS = 3,
+	CHQ_TIME_NANOSECONDS = 4
+};
+
+/*
+ * A typed view on an array owned by the caller, it is never copied.
+ */
+typedef struct _chq_column_t {
+	enum chq_data_type	 type;
+	enum chq_time_unit	 unit;
+	const void		*data;
+} chq_column_t;
+
+/*
+ * Pull-based series: called repeatedly to fill at most max values into the
+ * x and y buffers provided by the library, returns how many were written and
+ * zero at the end of the series. The offset is the number of points already
+ * consumed in this pass, it is zero at the beginning of every pass. A render
+ * makes one pass, but a chart rendered in strips makes one pass per strip and
+ * two per strip in density mode.
+ */
+typedef size_t (*chq_data_source_t)(void *, size_t, double *, double *,
+		size_t);
+
+/*
+ * Gorilla-style compressed block of points. The first timestamp and value
+ * are in the header, the bit stream (MSB first) holds the count - 1 points
+ * that follow, each one as a timestamp then a value:
+ *
+ *  - timestamp, as the delta-of-delta D with the previous delta (the
+ *    first delta is taken against zero), in two's complement:
+ *      '0'                D = 0
+ *      '10'   + 7 bits    D in [-64, 63]
+ *      '110'  + 9 bits    D in [-256, 255]
+ *      '1110' + 12 bits   D in [-2048, 2047]
+ *      '1111' + 64 bits   any other D
+ *  - value, as the XOR of its IEEE 754 bits with the previous value:
+ *      '0'                same value
+ *      '10' + bits        meaningful bits, in the previous leading and
+ *                         trailing zeros window
+ *      '11' + 5 bits leading zeros + 6 bits length (0 is 64) + bits
+ *
+ * The last point and the min/max header fields let the renderer skip or
+ * summarise whole blocks without decoding them.
+ */
+typedef struct _chq_block_t {
+	uint32_t		 count;
+	int64_t			 first_time;
+	double			 first_value;
+	int64_t			 last_time;
+	double			 last_value;
+	int64_t			 min_time;
+	int64_t			 max_time;
+	double			 min_value;
+	double			 max_value;
+	const uint8_t		*bits;
+	size_t			 bits_len;
+} chq_block_t;
+
+/* Returned by chq_block_encode() when the buffer is too small */
+#define CHQ_BLOCK_ENCODE_ERROR	((size_t)-1)
+
+/*
+ * Decoding state of a block, kept between chunks.
+ */
+typedef struct _chq_block_reader_t {
+	const chq_block_t	*block;
+	size_t			 bit;
+	uint32_t		 remaining;
+	int64_t			 time;
+	int64_t			 delta;
+	uint64_t		 value;
+	int			 leading;
+	int			 trailing;
+} chq_block_reader_t;
+
+/*
+ * Position of a reader going through the series of a chart.
+ */
+typedef struct _chq_cursor_t {
+	size_t			 pos;
+	size_t			 end;
+	/* compressed blocks */
+	size_t			 block;
+	chq_block_reader_t	 reader;
+} chq_cursor_t;
+
+enum chq_plot_mode {
+	CHQ_PLOT_AREA = 0,
+	CHQ_PLOT_DENSITY = 1
+};
+
+enum chq_density_scale {
+	CHQ_DENSITY_LINEAR = 0,
+	CHQ_DENSITY_LOG = 1
+};
+
+enum chq_plot_backend {
+	CHQ_BACKEND_CAIRO = 0,
+	CHQ_BACKEND_RASTER = 1
+};
+
+/*
+ * Direct access to the pixels of an ARGB32 image surface. The y_offset is
+ * the canvas row of the first row of data.
+ */
+typedef struct _chq_raster_t {
+	unsigned char		*data;
+	int			 width;
+	int			 height;
+	int			 stride;
+	int			 y_offset;
+} chq_raster_t;
+
+/*
+ * Per-pixel point counts over the plot area, or the part of it within a
+ * strip, used by the density mode.
+ */
+typedef struct _chq_density_t {
+	int			 left;
+	int			 top;
+	unsigned int		 width;
+	unsigned int		 height;
+	int			 closed_bottom;
+	uint32_t		*counts;
+	uint32_t		 max_count;
+} chq_density_t;
+
+/*
+ * Called once a chart was written, with CAIRO_STATUS_SUCCESS or the error
+ * that occurred. With an output queue it runs on the writer thread.
+ */
+typedef void (*chq_output_callback_t)(const char *, cairo_status_t, void *);
+
+typedef struct _chq_output_job_t {
+	cairo_surface_t		*surface;
+	char			*filename;
+	chq_output_callback_t	 callback;
+	void			*callback_data;
+} chq_output_job_t;
+
+/*
+ * Bounded queue of rendered surfaces waiting to be encoded and written by a
+ * background thread.
+ */
+typedef struct _chq_output_queue_t {
+	pthread_t		 thread;
+	pthread_mutex_t		 lock;
+	pthread_cond_t		 not_empty;
+	pthread_cond_t		 not_full;
+	pthread_cond_t		 drained;
+	chq_output_job_t	*jobs;
+	unsigned int		 capacity;
+	unsigned int		 head;
+	unsigned int		 count;
+	int			 busy;
+	int			 stopping;
+} chq_output_queue_t;
+
+/*
+ * Incremental PNG encoder fed with rows of ARGB32 pixels.
+ */
+typedef struct _chq_png_writer_t chq_png_writer_t;
+
+#define CHQ_SHM_MAGIC	0x46514843	/* "CHQF" */
+
+/*
+ * Header at the start of a shared-memory framebuffer, followed by two
+ * ARGB32 frames. The producer draws in the frame that is not the front one,
+ * then flips front and increments the sequence, which is also the futex word
+ * consumers sleep on.
+ */
+typedef struct _chq_shm_header_t {
+	uint32_t		 magic;
+	uint32_t		 width;
+	uint32_t		 height;
+	uint32_t		 stride;
+	uint32_t		 sequence;
+	uint32_t		 front;
+	uint64_t		 frame_offset[2];
+} chq_shm_header_t;
+
+typedef struct _chq_shm_t {
+	char			*name;
+	int			 fd;
+	int			 owner;
+	size_t			 size;
+	chq_shm_header_t	*header;
+} chq_shm_t;
+
+/*
+ * Snapshot of everything the static axes layer depends on. The layer is only
+ * re-rendered when the current key differs from the one it was drawn with.
+ */
+typedef struct _chq_axes_key_t {
+	unsigned int		 width;
+	unsigned int		 height;
+	double			 margin_top;
+	double			 margin_right;
+	double			 margin_bottom;
+	double			 margin_left;
+	struct {
+		double			 limit_min;
+		double			 limit_max;
+		char			*fontfamily;
+		double			 fontsize;
+		double			 padding;
+		cairo_font_slant_t	 slant;
+		cairo_font_weight_t	 weight;
+	} axis[2];
+} chq_axes_key_t;
+
 typedef struct _chq_dataplot_t {
 	cairo_t		*cr;
 	cairo_surface_t	*surface;
+	int		 surface_top;
 	unsigned int	 width;
 	unsigned int	 height;
 	char		*output_filename;
+	unsigned int	 strip_height;
+	chq_shm_t	*output_shm;
+	chq_output_queue_t	*output_queue;
+	chq_output_callback_t	 output_callback;
+	void		*output_callback_data;
 	/* axes */
 	chq_axis_t	*x_axis;
 	chq_axis_t	*y_axis;
@@ -63,16 +361,41 @@ typedef struct _chq_dataplot_t {
 	double		 margin_right;
 	double		 margin_bottom;
 	double		 margin_left;
+	/* cached axes, labels and background */
+	cairo_surface_t	*axes_layer;
+	chq_axes_key_t	 axes_key;
 	/* data */
 	size_t		 data_len;
-	double		*data_x;
-	double		*data_y;
+	chq_column_t	 column_x;
+	chq_column_t	 column_y;
+	chq_data_source_t	 data_source;
+	void		*data_source_data;
+	const chq_block_t	*blocks;
+	size_t		 blocks_len;
+	enum chq_time_unit	 blocks_unit;
+	/* plotting */
+	enum chq_plot_mode	 plot_mode;
+	enum chq_density_scale	 density_scale;
+	enum chq_plot_backend	 backend;
+	unsigned int	 threads;
 } chq_dataplot_t;
 
 
 /* strlcpy.c */
 size_t		 strlcpy(char *, const char *, size_t);
 
+/* atlas.c */
+chq_atlas_t	*chq_atlas_get(const char *, cairo_font_slant_t,
+			cairo_font_weight_t, double);
+int		 chq_atlas_matches(chq_atlas_t *, const char *,
+			cairo_font_slant_t, cairo_font_weight_t, double);
+unsigned int	 chq_atlas_generation(void);
+int		 chq_atlas_measure(chq_atlas_t *, const char *, double *,
+			double *);
+void		 chq_atlas_show(chq_atlas_t *, cairo_t *, double, double,
+			const char *);
+void		 chq_atlas_cleanup(void);
+
 /* axis.c */
 chq_axis_t 	*chq_axis_new(void);
 chq_axis_t 	*chq_axis_horizontal_new(void);
@@ -82,7 +405,9 @@ void		 chq_axis_set_limit(chq_axis_t *, double, double);
 double		 chq_axis_get_spread(chq_axis_t *);
 void		 chq_axis_set_size(chq_axis_t *, double);
 double		 chq_axis_convert_to_scale(chq_axis_t *, double);
+void		 chq_axis_get_transform(chq_axis_t *, double *, double *);
 void		 chq_axis_select_label_fontfamily(chq_axis_t *, cairo_t *);
+chq_atlas_t	*chq_axis_get_atlas(chq_axis_t *);
 double		 chq_axis_vertical_get_width(chq_axis_t *);
 double		 chq_axis_horizontal_get_height(chq_axis_t *);
 char 		*chq_axis_prerender_value(chq_axis_t *, cairo_t *, double, 
@@ -90,6 +415,72 @@ char 		*chq_axis_prerender_value(chq_axis_t *, cairo_t *, double,
 void		 chq_axis_calculate_label_size(chq_axis_t *, cairo_t *);
 void		 chq_axis_prerender_ticks(chq_axis_t *, cairo_t *);
 
+/* column.c */
+void		 chq_column_set(chq_column_t *, enum chq_data_type,
+			enum chq_time_unit, const void *);
+double		 chq_column_get_unit_scale(chq_column_t *);
+void		 chq_column_transform(chq_column_t *, size_t, size_t, double,
+			double, double *);
+
+/* density.c */
+chq_density_t	*chq_density_new(chq_dataplot_t *, unsigned int,
+			unsigned int);
+void		 chq_density_kill(chq_density_t *);
+void		 chq_density_bin(chq_density_t *, chq_dataplot_t *);
+void		 chq_density_blit(chq_density_t *, chq_raster_t *,
+			enum chq_density_scale);
+void		 chq_dataplot_render_density(chq_dataplot_t *);
+
+/* raster.c */
+void		 chq_raster_init(chq_raster_t *, cairo_surface_t *, int);
+void		 chq_raster_finish(chq_raster_t *, cairo_surface_t *);
+uint32_t	 chq_raster_rgb(double, double, double);
+void		 chq_raster_blend(chq_raster_t *, int, int, uint32_t, double);
+void		 chq_raster_fill_under(chq_raster_t *, double, double, double,
+			double, double, uint32_t);
+void		 chq_raster_line(chq_raster_t *, double, double, double,
+			double, double, uint32_t);
+void		 chq_dataplot_render_plots_raster(chq_dataplot_t *);
+
+/* output.c */
+cairo_status_t	 chq_output_write_png(cairo_surface_t *, const char *);
+chq_output_queue_t *chq_output_queue_new(unsigned int);
+void		 chq_output_queue_kill(chq_output_queue_t *);
+void		 chq_output_queue_push(chq_output_queue_t *, cairo_surface_t *,
+			const char *, chq_output_callback_t, void *);
+void		 chq_output_queue_wait(chq_output_queue_t *);
+
+/* strip.c */
+chq_png_writer_t *chq_png_writer_open(const char *, unsigned int,
+			unsigned int);
+cairo_status_t	 chq_png_writer_write_rows(chq_png_writer_t *,
+			const unsigned char *, int, unsigned int);
+cairo_status_t	 chq_png_writer_close(chq_png_writer_t *);
+cairo_status_t	 chq_dataplot_render_strips(chq_dataplot_t *);
+
+/* shm.c */
+chq_shm_t	*chq_shm_create(const char *, unsigned int, unsigned int);
+chq_shm_t	*chq_shm_open(const char *);
+void		 chq_shm_kill(chq_shm_t *);
+unsigned char	*chq_shm_get_frame(chq_shm_t *, unsigned int);
+cairo_surface_t	*chq_shm_get_back_surface(chq_shm_t *);
+void		 chq_shm_publish(chq_shm_t *);
+uint32_t	 chq_shm_wait(chq_shm_t *, uint32_t);
+uint32_t	 chq_shm_read(chq_shm_t *, unsigned char *);
+
+/* trace.c */
+int		 chq_trace_open(const char *);
+void		 chq_trace_close(void);
+void		 chq_trace_event(char, const char *, const char *);
+
+/* block.c */
+size_t		 chq_block_encode(chq_block_t *, const int64_t *, const double *,
+			uint32_t, uint8_t *, size_t);
+int		 chq_block_reader_next(chq_block_reader_t *, int64_t *,
+			double *);
+size_t		 chq_block_read_points(chq_dataplot_t *, chq_cursor_t *,
+			double *, double *, size_t);
+
 /* dataplot.c */
 chq_dataplot_t 	*chq_dataplot_new(void);
 void		 chq_dataplot_kill(chq_dataplot_t *);
@@ -104,8 +495,40 @@ void		 chq_dataplot_render_x_label_text(chq_dataplot_t *, double,
 void		 chq_dataplot_render_y_label_value(chq_dataplot_t *, double);
 void		 chq_dataplot_render_y_axis_labels(chq_dataplot_t *);
 void		 chq_dataplot_render_x_axis_labels(chq_dataplot_t *);
+void		 chq_dataplot_layout_axes(chq_dataplot_t *);
+void		 chq_dataplot_draw_axes(chq_dataplot_t *);
 void		 chq_dataplot_render_axes(chq_dataplot_t *);
-void		 chq_dataplot_render(chq_dataplot_t *);
+void		 chq_dataplot_invalidate_axes_layer(chq_dataplot_t *);
+void		 chq_dataplot_render_axes_layer(chq_dataplot_t *);
+void		 chq_dataplot_render_plots(chq_dataplot_t *);
+cairo_status_t	 chq_dataplot_render(chq_dataplot_t *);
 void		 chq_dataplot_set_width(chq_dataplot_t *, unsigned int);
 void		 chq_dataplot_set_height(chq_dataplot_t *, unsigned int);
 void		 chq_dataplot_set_output_file(chq_dataplot_t *, char *);
+void		 chq_dataplot_set_strip_height(chq_dataplot_t *,
+			unsigned int);
+void		 chq_dataplot_set_output_shm(chq_dataplot_t *, chq_shm_t *);
+void		 chq_dataplot_set_output_queue(chq_dataplot_t *,
+			chq_output_queue_t *);
+void		 chq_dataplot_set_output_callback(chq_dataplot_t *,
+			chq_output_callback_t, void *);
+void		 chq_dataplot_set_data(chq_dataplot_t *, double *, double *,
+			size_t);
+void		 chq_dataplot_set_plot_mode(chq_dataplot_t *,
+			enum chq_plot_mode);
+void		 chq_dataplot_set_density_scale(chq_dataplot_t *,
+			enum chq_density_scale);
+void		 chq_dataplot_set_threads(chq_dataplot_t *, unsigned int);
+void		 chq_dataplot_set_backend(chq_dataplot_t *,
+			enum chq_plot_backend);
+void		 chq_dataplot_set_columns(chq_dataplot_t *, chq_column_t *,
+			chq_column_t *, size_t);
+void		 chq_dataplot_set_data_source(chq_dataplot_t *,
+			chq_data_source_t, void *);
+void		 chq_dataplot_set_data_blocks(chq_dataplot_t *,
+			const chq_block_t *, size_t, enum chq_time_unit);
+void		 chq_dataplot_get_plot_origin(chq_dataplot_t *, double *,
+			double *);
+void		 chq_dataplot_cursor_init(chq_dataplot_t *, chq_cursor_t *);
+size_t		 chq_dataplot_read_points(chq_dataplot_t *, chq_cursor_t *,
+			double *, double *, size_t);
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2010, Bertrand Janin <tamentis@neopulsar.org>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <cairo.h>
+
+#include "chartesque.h"
+
+
+/**
+ * Point a column to a caller-owned array of the given type.
+ */
+void
+chq_column_set(chq_column_t *column, enum chq_data_type type,
+		enum chq_time_unit unit, const void *data)
+{
+	column->type = type;
+	column->unit = unit;
+	column->data = data;
+}
+
+
+/**
+ * Return the factor converting the raw values of this column to seconds, or
+ * 1.0 if the column does not hold time values.
+ */
+double
+chq_column_get_unit_scale(chq_column_t *column)
+{
+	switch (column->unit) {
+	case CHQ_TIME_MILLISECONDS:
+		return 1e-3;
+	case CHQ_TIME_MICROSECONDS:
+		return 1e-6;
+	case CHQ_TIME_NANOSECONDS:
+		return 1e-9;
+	case CHQ_TIME_SECONDS:
+	case CHQ_TIME_NONE:
+	default:
+		return 1.0;
+	}
+}
+
+
+/**
+ * Convert count values starting at start to canvas coordinates, as
+ * scale * value + offset, into out. The widening to double and the unit
+ * conversion are folded into the same loop so the series never needs to be
+ * copied as doubles beforehand.
+ */
+void
+chq_column_transform(chq_column_t *column, size_t start, size_t count,
+		double scale, double offset, double *out)
+{
+	size_t i;
+
+	scale *= chq_column_get_unit_scale(column);
+
+	switch (column->type) {
+	case CHQ_DATA_FLOAT32: {
+		const float *data = (const float *)column->data + start;
+		for (i = 0; i < count; i++)
+			out[i] = (double)data[i] * scale + offset;
+		break;
+	}
+	case CHQ_DATA_INT32: {
+		const int32_t *data = (const int32_t *)column->data + start;
+		for (i = 0; i < count; i++)
+			out[i] = (double)data[i] * scale + offset;
+		break;
+	}
+	case CHQ_DATA_INT64: {
+		const int64_t *data = (const int64_t *)column->data + start;
+		for (i = 0; i < count; i++)
+			out[i] = (double)data[i] * scale + offset;
+		break;
+	}
+	case CHQ_DATA_FLOAT64:
+	default: {
+		const double *data = (const double *)column->data + start;
+		for (i = 0; i < count; i++)
+			out[i] = data[i] * scale + offset;
+		break;
+	}
+	}
+}
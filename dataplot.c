@@ -15,6 +15,7 @@
  */
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,6 +38,14 @@ chq_dataplot_new()
 	chart->width = 800;
 	chart->height = 600;
 	chart->output_filename = strdup("output.png");
+	chart->output_queue = NULL;
+	chart->output_callback = NULL;
+	chart->output_callback_data = NULL;
+	chart->strip_height = 0;
+	chart->output_shm = NULL;
+	chart->cr = NULL;
+	chart->surface = NULL;
+	chart->surface_top = 0;
 
 	chart->x_axis = chq_axis_horizontal_new();
 	chart->y_axis = chq_axis_vertical_new();
@@ -46,6 +55,23 @@ chq_dataplot_new()
 	chart->margin_bottom = 10.0;
 	chart->margin_left = 10.0;
 
+	chart->axes_layer = NULL;
+	memset(&chart->axes_key, 0, sizeof(chq_axes_key_t));
+
+	chart->data_len = 0;
+	chq_column_set(&chart->column_x, CHQ_DATA_FLOAT64, CHQ_TIME_NONE, NULL);
+	chq_column_set(&chart->column_y, CHQ_DATA_FLOAT64, CHQ_TIME_NONE, NULL);
+	chart->data_source = NULL;
+	chart->data_source_data = NULL;
+	chart->blocks = NULL;
+	chart->blocks_len = 0;
+	chart->blocks_unit = CHQ_TIME_NONE;
+
+	chart->plot_mode = CHQ_PLOT_AREA;
+	chart->density_scale = CHQ_DENSITY_LINEAR;
+	chart->threads = 0;
+	chart->backend = CHQ_BACKEND_CAIRO;
+
 	return chart;
 }
 
@@ -58,6 +84,7 @@ chq_dataplot_kill(chq_dataplot_t *chart)
 {
 	chq_axis_kill(chart->x_axis);
 	chq_axis_kill(chart->y_axis);
+	chq_dataplot_invalidate_axes_layer(chart);
 	free(chart->output_filename);
 	free(chart);
 }
@@ -86,37 +113,30 @@ chq_dataplot_get_text_size(cairo_t *cr, const char *family,
 
 
 /**
- * Used by cairo to save to file.
- * @private
- */
-static cairo_status_t
-stdio_write (void *closure, const unsigned char *data, unsigned int length)
-{
-	FILE *file = closure;
-
-	if (fwrite (data, 1, length, file) == length) {
-		return CAIRO_STATUS_SUCCESS;
-	} else {
-		return CAIRO_STATUS_WRITE_ERROR;
-	}
-}
-
-
-/**
- * Render a label for the y-axis, they are always right-aligned.
+ * Render a label for the y-axis, they are always right-aligned. Labels only
+ * made of atlas characters are blitted from the glyph atlas, anything else
+ * goes through a cairo text path.
  */
 void
 chq_dataplot_render_y_label_text(chq_dataplot_t *chart, double y, char *text)
 {
 	cairo_text_extents_t extents;
+	chq_atlas_t *atlas = chq_axis_get_atlas(chart->y_axis);
+	double width, height;
+	double right = chart->margin_left + chart->y_axis->label_padding +
+		chart->y_axis->label_max_width;
+
+	y += chart->margin_top + chart->y_axis->label_padding;
+
+	if (chq_atlas_measure(atlas, text, &width, &height) == 0) {
+		chq_atlas_show(atlas, chart->cr, right - width, y, text);
+		return;
+	}
 
 	cairo_text_extents(chart->cr, text, &extents);
 
 	cairo_set_font_size(chart->cr, chart->y_axis->label_fontsize);
-	cairo_move_to(chart->cr, chart->margin_left +
-			chart->y_axis->label_padding +
-			chart->y_axis->label_max_width - extents.width,
-			chart->margin_top + chart->y_axis->label_padding + y);
+	cairo_move_to(chart->cr, right - extents.width, y);
 	cairo_text_path(chart->cr, text);
 }
 
@@ -133,21 +153,29 @@ chq_dataplot_get_x_label_y(chq_dataplot_t *chart)
 
 
 /**
- * Render a label for the x-axis, centered.
+ * Render a label for the x-axis, centered. Uses the glyph atlas whenever
+ * possible, like the y-axis labels.
  */
 void
 chq_dataplot_render_x_label_text(chq_dataplot_t *chart, double x, char *text)
 {
 	cairo_text_extents_t extents;
-	double x_label_y;
+	chq_atlas_t *atlas = chq_axis_get_atlas(chart->x_axis);
+	double x_label_y, width, height;
 
-	cairo_text_extents(chart->cr, text, &extents);
 	x_label_y = chq_dataplot_get_x_label_y(chart);
+	x += chart->margin_left + chq_axis_vertical_get_width(chart->y_axis);
+
+	if (chq_atlas_measure(atlas, text, &width, &height) == 0) {
+		chq_atlas_show(atlas, chart->cr, x - width / 2.0, x_label_y,
+				text);
+		return;
+	}
+
+	cairo_text_extents(chart->cr, text, &extents);
 
 	cairo_set_font_size(chart->cr, chart->x_axis->label_fontsize);
-	cairo_move_to(chart->cr, chart->margin_left +
-			chq_axis_vertical_get_width(chart->y_axis) + x -
-			extents.width / 2.0, x_label_y);
+	cairo_move_to(chart->cr, x - extents.width / 2.0, x_label_y);
 	cairo_text_path(chart->cr, text);
 }
 
@@ -194,13 +222,12 @@ chq_dataplot_render_x_axis_labels(chq_dataplot_t *chart)
 
 
 /**
- * Routine drawing the axes.
+ * Compute the label sizes, axes sizes and ticks. This has to run before any
+ * of the axes or the plots are drawn.
  */
 void
-chq_dataplot_render_axes(chq_dataplot_t *chart)
+chq_dataplot_layout_axes(chq_dataplot_t *chart)
 {
-	double y_axis_width, x_axis_height;
-
 	/* 
 	 * Calculate the max width and heights of the labels, it will be used
 	 * to get a proper size for the axes. The sizing is done on a sample
@@ -220,6 +247,18 @@ chq_dataplot_render_axes(chq_dataplot_t *chart)
 	/* Generate the ticks (positions and labels) */
 	chq_axis_prerender_ticks(chart->x_axis, chart->cr);
 	chq_axis_prerender_ticks(chart->y_axis, chart->cr);
+}
+
+
+/**
+ * Routine drawing the axes, the layout needs to be done already.
+ */
+void
+chq_dataplot_draw_axes(chq_dataplot_t *chart)
+{
+	double y_axis_width, x_axis_height;
+
+	CHQ_TRACE_BEGIN("draw_axes", NULL);
 
 	/* Select axes color */
 	cairo_set_source_rgb(chart->cr, 0.2, 0.2, 0.2);
@@ -244,63 +283,489 @@ chq_dataplot_render_axes(chq_dataplot_t *chart)
 
 	cairo_fill(chart->cr);
 	cairo_stroke(chart->cr);
+
+	CHQ_TRACE_END("draw_axes");
 }
 
 
+/**
+ * Routine computing and drawing the axes.
+ */
 void
-chq_dataplot_render_plots(chq_dataplot_t *chart)
+chq_dataplot_render_axes(chq_dataplot_t *chart)
 {
-	size_t i;
-	double x_axis_height = chq_axis_horizontal_get_height(chart->x_axis);
-	double y_axis_width = chq_axis_vertical_get_width(chart->y_axis);
-	double left = chart->margin_left + y_axis_width;
-	double top = chart->margin_top;
-	double x, y;
+	chq_dataplot_layout_axes(chart);
+	chq_dataplot_draw_axes(chart);
+}
 
-	cairo_save(chart->cr);
+
+/**
+ * Fill the key with the current values of everything the axes layer depends
+ * on. The font families are borrowed from the axes, the key of the chart
+ * holds its own copies.
+ * @private
+ */
+static void
+chq_dataplot_get_axes_key(chq_dataplot_t *chart, chq_axes_key_t *key)
+{
+	chq_axis_t *axes[2] = { chart->x_axis, chart->y_axis };
+	int i;
+
+	memset(key, 0, sizeof(chq_axes_key_t));
+
+	key->width = chart->width;
+	key->height = chart->height;
+	key->margin_top = chart->margin_top;
+	key->margin_right = chart->margin_right;
+	key->margin_bottom = chart->margin_bottom;
+	key->margin_left = chart->margin_left;
+
+	for (i = 0; i < 2; i++) {
+		key->axis[i].limit_min = axes[i]->limit_min;
+		key->axis[i].limit_max = axes[i]->limit_max;
+		key->axis[i].fontfamily = axes[i]->label_fontfamily;
+		key->axis[i].fontsize = axes[i]->label_fontsize;
+		key->axis[i].padding = axes[i]->label_padding;
+		key->axis[i].slant = axes[i]->label_slant;
+		key->axis[i].weight = axes[i]->label_weight;
+	}
+}
+
+
+/**
+ * Return true if two keys hold the same values, the font families are
+ * compared as whole strings.
+ * @private
+ */
+static int
+chq_dataplot_axes_key_equal(chq_axes_key_t *a, chq_axes_key_t *b)
+{
+	int i;
+
+	if (a->width != b->width || a->height != b->height ||
+			a->margin_top != b->margin_top ||
+			a->margin_right != b->margin_right ||
+			a->margin_bottom != b->margin_bottom ||
+			a->margin_left != b->margin_left)
+		return 0;
+
+	for (i = 0; i < 2; i++) {
+		if (a->axis[i].limit_min != b->axis[i].limit_min ||
+				a->axis[i].limit_max != b->axis[i].limit_max ||
+				a->axis[i].fontsize != b->axis[i].fontsize ||
+				a->axis[i].padding != b->axis[i].padding ||
+				a->axis[i].slant != b->axis[i].slant ||
+				a->axis[i].weight != b->axis[i].weight ||
+				strcmp(a->axis[i].fontfamily,
+					b->axis[i].fontfamily) != 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+
+/**
+ * Drop the cached axes layer, it will be re-rendered on the next render.
+ */
+void
+chq_dataplot_invalidate_axes_layer(chq_dataplot_t *chart)
+{
+	int i;
+
+	if (chart->axes_layer != NULL) {
+		cairo_surface_destroy(chart->axes_layer);
+		chart->axes_layer = NULL;
+	}
+
+	for (i = 0; i < 2; i++) {
+		free(chart->axes_key.axis[i].fontfamily);
+		chart->axes_key.axis[i].fontfamily = NULL;
+	}
+}
+
+
+/**
+ * Make sure the axes layer (background, axes and labels) is up to date. It
+ * is only laid out and drawn again if the size, margins, limits or fonts
+ * changed since the last time, otherwise this is a simple comparison.
+ */
+void
+chq_dataplot_render_axes_layer(chq_dataplot_t *chart)
+{
+	chq_axes_key_t key;
+	cairo_t *cr;
+	int i;
+
+	chq_dataplot_get_axes_key(chart, &key);
+
+	if (chart->axes_layer != NULL &&
+			chq_dataplot_axes_key_equal(&key, &chart->axes_key))
+		return;
+
+	chq_dataplot_invalidate_axes_layer(chart);
+
+	chart->axes_layer = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+			chart->width, chart->height);
+
+	/* Temporarily swap the context to draw on the layer */
+	cr = chart->cr;
+	chart->cr = cairo_create(chart->axes_layer);
+	chq_dataplot_render_axes(chart);
+	cairo_destroy(chart->cr);
+	chart->cr = cr;
+
+	cairo_surface_flush(chart->axes_layer);
+	memcpy(&chart->axes_key, &key, sizeof(key));
+	for (i = 0; i < 2; i++)
+		chart->axes_key.axis[i].fontfamily =
+			strdup(key.axis[i].fontfamily);
+}
+
+
+/**
+ * Return the canvas position of the origin of the axes scales, i.e. where a
+ * scale coordinate of (0, 0) lands on the surface.
+ */
+void
+chq_dataplot_get_plot_origin(chq_dataplot_t *chart, double *left, double *top)
+{
+	*left = chart->margin_left + chq_axis_vertical_get_width(chart->y_axis);
+	*top = chart->margin_top;
+}
+
+
+/**
+ * Rewind a cursor to the beginning of the chart's series.
+ */
+void
+chq_dataplot_cursor_init(chq_dataplot_t *chart, chq_cursor_t *cursor)
+{
+	cursor->pos = 0;
+	cursor->block = 0;
+	cursor->reader.remaining = 0;
+	if (chart->data_source != NULL || chart->blocks != NULL) {
+		cursor->end = SIZE_MAX;
+	} else {
+		cursor->end = chart->data_len;
+	}
+}
+
+
+/**
+ * Pull the next chunk from the data source of the chart and convert it in
+ * place, the source writes straight into the caller's buffers.
+ * @private
+ */
+static size_t
+chq_dataplot_read_source(chq_dataplot_t *chart, chq_cursor_t *cursor,
+		double *x, double *y, size_t max)
+{
+	double left, top, x_scale, x_offset, y_scale, y_offset;
+	size_t i, count;
+
+	count = chart->data_source(chart->data_source_data, cursor->pos, x, y,
+			max);
+	if (count == 0) {
+		cursor->pos = cursor->end;
+		return 0;
+	}
+	if (count > max)
+		count = max;
+
+	chq_dataplot_get_plot_origin(chart, &left, &top);
+	chq_axis_get_transform(chart->x_axis, &x_scale, &x_offset);
+	chq_axis_get_transform(chart->y_axis, &y_scale, &y_offset);
+	x_offset += left;
+	y_offset += top;
+
+	for (i = 0; i < count; i++) {
+		x[i] = x[i] * x_scale + x_offset;
+		y[i] = y[i] * y_scale + y_offset;
+	}
+
+	cursor->pos += count;
+
+	return count;
+}
+
+
+/**
+ * Read up to max points from the cursor, already converted to canvas
+ * coordinates, into the x and y buffers. Returns the number of points read,
+ * zero once the series is exhausted. The axes need to be laid out.
+ */
+size_t
+chq_dataplot_read_points(chq_dataplot_t *chart, chq_cursor_t *cursor,
+		double *x, double *y, size_t max)
+{
+	double left, top, x_scale, x_offset, y_scale, y_offset;
+	size_t count;
+
+	if (cursor->pos >= cursor->end)
+		return 0;
+
+	if (chart->data_source != NULL)
+		return chq_dataplot_read_source(chart, cursor, x, y, max);
+	if (chart->blocks != NULL)
+		return chq_block_read_points(chart, cursor, x, y, max);
+
+	count = cursor->end - cursor->pos;
+	if (count > max)
+		count = max;
+
+	chq_dataplot_get_plot_origin(chart, &left, &top);
+	chq_axis_get_transform(chart->x_axis, &x_scale, &x_offset);
+	chq_axis_get_transform(chart->y_axis, &y_scale, &y_offset);
+
+	chq_column_transform(&chart->column_x, cursor->pos, count, x_scale,
+			x_offset + left, x);
+	chq_column_transform(&chart->column_y, cursor->pos, count, y_scale,
+			y_offset + top, y);
+
+	cursor->pos += count;
+
+	return count;
+}
+
+
+/**
+ * Fill the area between points from..to and the baseline as one polygon.
+ * @private
+ */
+static void
+chq_dataplot_fill_polygon(chq_dataplot_t *chart, double *x, double *y,
+		size_t from, size_t to, double base)
+{
+	size_t i;
 
 	cairo_new_path(chart->cr);
-	x = chq_axis_convert_to_scale(chart->x_axis, chart->x_axis->limit_min);
-	y = chq_axis_convert_to_scale(chart->y_axis, chart->y_axis->limit_min);
-	cairo_move_to(chart->cr, left + x, top + y);
-	for (i = 0; i < chart->data_len; i++) {
-		x = chq_axis_convert_to_scale(chart->x_axis, chart->data_x[i]);
-		y = chq_axis_convert_to_scale(chart->y_axis, chart->data_y[i]);
-		printf("x: %f -> %f\n", chart->data_x[i], x);
-		cairo_line_to(chart->cr, left + x, top + y);
+	cairo_move_to(chart->cr, x[from], base);
+	for (i = from; i <= to; i++) {
+		cairo_line_to(chart->cr, x[i], y[i]);
 	}
+	cairo_line_to(chart->cr, x[to], base);
+	cairo_close_path(chart->cr);
+
+	cairo_fill(chart->cr);
+}
+
+
+/**
+ * Fill the area between points from..to and the baseline, one x-monotone
+ * polygon per run of points going in the same direction, so a series going
+ * back on itself never makes a self-intersecting polygon.
+ * @private
+ */
+static void
+chq_dataplot_fill_chunk(chq_dataplot_t *chart, double *x, double *y,
+		size_t from, size_t to, double base)
+{
+	size_t i, start = from;
+	int direction = 0, step;
+
+	CHQ_TRACE_BEGIN("fill_chunk", NULL);
 
 	cairo_set_source_rgb(chart->cr, 0.4, 0.6, 1.0);
-	cairo_fill_preserve(chart->cr);
+
+	for (i = from; i < to; i++) {
+		step = (x[i + 1] > x[i]) - (x[i + 1] < x[i]);
+		if (step == 0)
+			continue;
+		if (direction != 0 && step != direction) {
+			chq_dataplot_fill_polygon(chart, x, y, start, i, base);
+			start = i;
+		}
+		direction = step;
+	}
+	chq_dataplot_fill_polygon(chart, x, y, start, to, base);
+
+	CHQ_TRACE_END("fill_chunk");
+}
+
+
+/**
+ * Stroke points from..to as one open sub-path.
+ * @private
+ */
+static void
+chq_dataplot_stroke_chunk(chq_dataplot_t *chart, double *x, double *y,
+		size_t from, size_t to)
+{
+	size_t i;
+
+	CHQ_TRACE_BEGIN("stroke_chunk", NULL);
+
+	cairo_new_path(chart->cr);
+	cairo_move_to(chart->cr, x[from], y[from]);
+	for (i = from + 1; i <= to; i++) {
+		cairo_line_to(chart->cr, x[i], y[i]);
+	}
 
 	cairo_set_source_rgb(chart->cr, 0.2, 0.4, 0.7);
 	cairo_set_line_width(chart->cr, 2);
 	cairo_stroke(chart->cr);
 
-	cairo_restore(chart->cr);
+	CHQ_TRACE_END("stroke_chunk");
 }
 
 
 /**
- * Render the chq_dataplot.
+ * Draw the series as a filled area, reading it chunk by chunk. Each chunk
+ * is filled down to the baseline and stroked as its own path, so cairo
+ * never has to tessellate more than a chunk at a time.
+ *
+ * Both buffers hold the second to last and the last point of the previous
+ * chunk before the points of the chunk itself, so every fill and stroke
+ * overlaps the previous one by a segment: the seam of a fill lies inside
+ * the next one and every join is drawn by one sub-path. The stroke of a
+ * chunk is drawn after the fill of the next one, which would otherwise
+ * cover the end of the line.
  */
 void
+chq_dataplot_render_plots(chq_dataplot_t *chart)
+{
+	chq_cursor_t cursor;
+	double buffers[2][2][CHQ_CHUNK_SIZE + 2];
+	double *cur_x, *cur_y, *prev_x, *prev_y, *swap;
+	size_t count, cur_from, prev_from = 0, prev_to = 0;
+	double left, top, base;
+
+	chq_dataplot_get_plot_origin(chart, &left, &top);
+
+	cur_x = buffers[0][0];
+	cur_y = buffers[0][1];
+	prev_x = buffers[1][0];
+	prev_y = buffers[1][1];
+
+	/* The area starts from the bottom-left corner of the plot */
+	base = top + chq_axis_convert_to_scale(chart->y_axis,
+			chart->y_axis->limit_min);
+	cur_x[1] = left + chq_axis_convert_to_scale(chart->x_axis,
+			chart->x_axis->limit_min);
+	cur_y[1] = base;
+	cur_from = 1;
+
+	cairo_save(chart->cr);
+
+	chq_dataplot_cursor_init(chart, &cursor);
+	while ((count = chq_dataplot_read_points(chart, &cursor, cur_x + 2,
+					cur_y + 2, CHQ_CHUNK_SIZE)) > 0) {
+		chq_dataplot_fill_chunk(chart, cur_x, cur_y, cur_from,
+				count + 1, base);
+		if (prev_to > 0)
+			chq_dataplot_stroke_chunk(chart, prev_x, prev_y,
+					prev_from, prev_to);
+
+		swap = prev_x; prev_x = cur_x; cur_x = swap;
+		swap = prev_y; prev_y = cur_y; cur_y = swap;
+		prev_from = cur_from;
+		prev_to = count + 1;
+
+		/* The next chunk carries on from the last two points */
+		cur_x[0] = prev_x[count];
+		cur_y[0] = prev_y[count];
+		cur_x[1] = prev_x[count + 1];
+		cur_y[1] = prev_y[count + 1];
+		cur_from = 0;
+	}
+
+	if (prev_to > 0)
+		chq_dataplot_stroke_chunk(chart, prev_x, prev_y, prev_from,
+				prev_to);
+
+	cairo_new_path(chart->cr);
+	cairo_restore(chart->cr);
+}
+
+
+/**
+ * Render the chq_dataplot. If an output queue is set, the surface is handed
+ * over to it and the encoding and writing happen in the background, errors
+ * are then only reported to the output callback. Otherwise the file is
+ * written before returning and the status is returned. Charts taller than
+ * the strip height, if set, are rendered and written one strip at a time.
+ * With a shared-memory framebuffer, the chart is drawn straight into its
+ * back frame which is then published, nothing is encoded.
+ */
+cairo_status_t
 chq_dataplot_render(chq_dataplot_t *chart)
 {
-	FILE *fp;
+	cairo_status_t status = CAIRO_STATUS_SUCCESS;
+
+	CHQ_TRACE_BEGIN("render", chart->output_filename);
+
+	if (chart->output_shm != NULL) {
+		if (chart->output_shm->header->width != chart->width ||
+				chart->output_shm->header->height !=
+				chart->height) {
+			status = CAIRO_STATUS_INVALID_SIZE;
+			goto report;
+		}
+		chart->surface = chq_shm_get_back_surface(chart->output_shm);
+	} else if (chart->strip_height > 0 &&
+			chart->strip_height < chart->height) {
+		status = chq_dataplot_render_strips(chart);
+		CHQ_TRACE_END("render");
+		return status;
+	} else {
+		chart->surface = cairo_image_surface_create(
+				CAIRO_FORMAT_ARGB32, chart->width,
+				chart->height);
+	}
 
-	chart->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
-			chart->width, chart->height);
+	chart->surface_top = 0;
 	chart->cr = cairo_create(chart->surface);
 
-	chq_dataplot_render_axes(chart);
-	chq_dataplot_render_plots(chart);
+	/* The layer replaces whatever a reused surface held before */
+	chq_dataplot_render_axes_layer(chart);
+	cairo_set_operator(chart->cr, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_surface(chart->cr, chart->axes_layer, 0, 0);
+	cairo_paint(chart->cr);
+	cairo_set_operator(chart->cr, CAIRO_OPERATOR_OVER);
+
+	switch (chart->plot_mode) {
+	case CHQ_PLOT_DENSITY:
+		chq_dataplot_render_density(chart);
+		break;
+	case CHQ_PLOT_AREA:
+	default:
+		if (chart->backend == CHQ_BACKEND_RASTER)
+			chq_dataplot_render_plots_raster(chart);
+		else
+			chq_dataplot_render_plots(chart);
+		break;
+	}
 
-	fp = fopen(chart->output_filename, "w");
-	cairo_surface_write_to_png_stream(chart->surface, stdio_write, fp);
 	cairo_destroy(chart->cr);
-	cairo_surface_destroy(chart->surface);
-	fclose(fp);
+	chart->cr = NULL;
+
+	if (chart->output_shm != NULL) {
+		cairo_surface_flush(chart->surface);
+		cairo_surface_destroy(chart->surface);
+		chq_shm_publish(chart->output_shm);
+	} else if (chart->output_queue != NULL) {
+		chq_output_queue_push(chart->output_queue, chart->surface,
+				chart->output_filename, chart->output_callback,
+				chart->output_callback_data);
+		chart->surface = NULL;
+		CHQ_TRACE_END("render");
+		return status;
+	} else {
+		status = chq_output_write_png(chart->surface,
+				chart->output_filename);
+		cairo_surface_destroy(chart->surface);
+	}
+	chart->surface = NULL;
+
+report:
+	if (chart->output_callback != NULL)
+		chart->output_callback(chart->output_filename, status,
+				chart->output_callback_data);
+
+	CHQ_TRACE_END("render");
+
+	return status;
 }
 
 
@@ -335,6 +800,101 @@ chq_dataplot_set_output_file(chq_dataplot_t *chart, char *filename)
 }
 
 
+/**
+ * Setter for the strip height, charts taller than this are rendered this
+ * many rows at a time into a reusable surface and streamed to the PNG file,
+ * keeping the memory proportional to the strip rather than the chart. Strips
+ * are always written synchronously, the output queue is not used. The
+ * series is read again for every strip. Zero disables strips.
+ */
+void
+chq_dataplot_set_strip_height(chq_dataplot_t *chart, unsigned int rows)
+{
+	chart->strip_height = rows;
+}
+
+
+/**
+ * Setter for the shared-memory framebuffer the chart is published to instead
+ * of a file, it needs to have the size of the chart. Pass NULL to go back to
+ * files. The framebuffer is not owned by the chart.
+ */
+void
+chq_dataplot_set_output_shm(chq_dataplot_t *chart, chq_shm_t *shm)
+{
+	chart->output_shm = shm;
+}
+
+
+/**
+ * Setter for the output queue, the rendered charts are then written in the
+ * background. Pass NULL to write synchronously again. The queue is not owned
+ * by the chart.
+ */
+void
+chq_dataplot_set_output_queue(chq_dataplot_t *chart, chq_output_queue_t *queue)
+{
+	chart->output_queue = queue;
+}
+
+
+/**
+ * Setter for the callback reporting the outcome of each write.
+ */
+void
+chq_dataplot_set_output_callback(chq_dataplot_t *chart,
+		chq_output_callback_t callback, void *data)
+{
+	chart->output_callback = callback;
+	chart->output_callback_data = data;
+}
+
+
+/**
+ * Setter for the way the series is drawn, either as a filled area or as a
+ * per-pixel density map for very large scatter data.
+ */
+void
+chq_dataplot_set_plot_mode(chq_dataplot_t *chart, enum chq_plot_mode mode)
+{
+	chart->plot_mode = mode;
+}
+
+
+/**
+ * Setter for the scaling of the counts in density mode.
+ */
+void
+chq_dataplot_set_density_scale(chq_dataplot_t *chart,
+		enum chq_density_scale scale)
+{
+	chart->density_scale = scale;
+}
+
+
+/**
+ * Setter for the number of threads used to bin the data in density mode,
+ * zero means one per online CPU.
+ */
+void
+chq_dataplot_set_threads(chq_dataplot_t *chart, unsigned int threads)
+{
+	chart->threads = threads;
+}
+
+
+/**
+ * Setter for the backend drawing the series in area mode. The raster backend
+ * writes the pixels directly instead of going through a cairo path, which is
+ * much cheaper on large series. The axes are always drawn with cairo.
+ */
+void
+chq_dataplot_set_backend(chq_dataplot_t *chart, enum chq_plot_backend backend)
+{
+	chart->backend = backend;
+}
+
+
 /**
  * Assign the data arrays.
  */
@@ -343,7 +903,63 @@ chq_dataplot_set_data(chq_dataplot_t *chart, double *data_x, double *data_y,
 		size_t data_len)
 {
 	chart->data_len = data_len;
-	chart->data_x = data_x;
-	chart->data_y = data_y;
+	chart->data_source = NULL;
+	chart->blocks = NULL;
+	chq_column_set(&chart->column_x, CHQ_DATA_FLOAT64, CHQ_TIME_NONE,
+			data_x);
+	chq_column_set(&chart->column_y, CHQ_DATA_FLOAT64, CHQ_TIME_NONE,
+			data_y);
+}
+
+
+/**
+ * Assign typed data columns, they are read in their native type at render
+ * time. The arrays are not copied and need to outlive the render.
+ */
+void
+chq_dataplot_set_columns(chq_dataplot_t *chart, chq_column_t *column_x,
+		chq_column_t *column_y, size_t data_len)
+{
+	chart->data_len = data_len;
+	chart->data_source = NULL;
+	chart->blocks = NULL;
+	chart->column_x = *column_x;
+	chart->column_y = *column_y;
+}
+
+
+/**
+ * Assign a pull-based data source, the series is then read from it in
+ * chunks of CHQ_CHUNK_SIZE points and never needs to be held in memory as a
+ * whole. It is read from the start once per render, but once per strip when
+ * a strip height is set (twice in density mode): a source backed by storage
+ * is pulled height / strip_height times per render.
+ */
+void
+chq_dataplot_set_data_source(chq_dataplot_t *chart, chq_data_source_t source,
+		void *data)
+{
+	chart->data_len = 0;
+	chart->blocks = NULL;
+	chart->data_source = source;
+	chart->data_source_data = data;
+}
+
+
+/**
+ * Assign a series stored as compressed blocks, in time order. The blocks
+ * are decoded on the fly while rendering, whole blocks outside of the x
+ * limits or narrower than a pixel are never decoded. The timestamps are
+ * in the given unit, the blocks are not copied.
+ */
+void
+chq_dataplot_set_data_blocks(chq_dataplot_t *chart, const chq_block_t *blocks,
+		size_t blocks_len, enum chq_time_unit unit)
+{
+	chart->data_len = 0;
+	chart->data_source = NULL;
+	chart->blocks = blocks;
+	chart->blocks_len = blocks_len;
+	chart->blocks_unit = unit;
 }
 
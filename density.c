@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2010, Bertrand Janin <tamentis@neopulsar.org>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <cairo.h>
+
+#include "chartesque.h"
+
+/* Below this many points per thread, spawning is not worth it. */
+#define DENSITY_MIN_POINTS_PER_THREAD	65536
+
+/* Colors of the ramp, from the least to the most dense pixels. */
+#define DENSITY_LOW_R	0.75
+#define DENSITY_LOW_G	0.85
+#define DENSITY_LOW_B	1.0
+#define DENSITY_HIGH_R	0.1
+#define DENSITY_HIGH_G	0.2
+#define DENSITY_HIGH_B	0.5
+
+typedef struct _chq_density_job_t {
+	chq_dataplot_t	*chart;
+	chq_density_t	*density;
+	chq_cursor_t	 cursor;
+	uint32_t	*counts;
+	int		 spawned;
+} chq_density_job_t;
+
+
+/**
+ * Constructor for a density grid covering the plot area of the chart within
+ * the given rows of the chart, the axes need to be laid out. The grid is
+ * clipped to the surface.
+ */
+chq_density_t *
+chq_density_new(chq_dataplot_t *chart, unsigned int first_row,
+		unsigned int rows)
+{
+	chq_density_t *density = malloc(sizeof(chq_density_t));
+	double left, top;
+	int right, bottom, plot_bottom;
+
+	chq_dataplot_get_plot_origin(chart, &left, &top);
+
+	density->left = (int)floor(left);
+	density->top = (int)floor(top);
+	right = (int)ceil(left + chart->x_axis->size);
+	plot_bottom = (int)ceil(top + chart->y_axis->size);
+
+	if (density->left < 0)
+		density->left = 0;
+	if (density->top < (int)first_row)
+		density->top = first_row;
+	if (right > (int)chart->width)
+		right = chart->width;
+	if (plot_bottom > (int)chart->height)
+		plot_bottom = chart->height;
+	bottom = plot_bottom;
+	if (bottom > (int)(first_row + rows))
+		bottom = first_row + rows;
+
+	density->width = right > density->left ? right - density->left : 0;
+	density->height = bottom > density->top ? bottom - density->top : 0;
+	density->closed_bottom = bottom == plot_bottom;
+	density->counts = calloc((size_t)density->width * density->height,
+			sizeof(uint32_t));
+	density->max_count = 0;
+
+	return density;
+}
+
+
+/**
+ * Destructor for a density grid.
+ */
+void
+chq_density_kill(chq_density_t *density)
+{
+	free(density->counts);
+	free(density);
+}
+
+
+/**
+ * Accumulate the points of a cursor range into a grid of counts.
+ * @private
+ */
+static void *
+chq_density_bin_job(void *arg)
+{
+	chq_density_job_t *job = arg;
+	chq_density_t *density = job->density;
+	double x[CHQ_CHUNK_SIZE], y[CHQ_CHUNK_SIZE];
+	double px, py;
+	size_t i, count;
+
+	while ((count = chq_dataplot_read_points(job->chart, &job->cursor,
+					x, y, CHQ_CHUNK_SIZE)) > 0) {
+		for (i = 0; i < count; i++) {
+			px = x[i] - density->left;
+			py = y[i] - density->top;
+
+			/*
+			 * Closed on the far edges so limit_max on x and
+			 * limit_min on y land in the last column and row,
+			 * unless the bottom edge is only the end of a strip.
+			 * Also rejects NaN.
+			 */
+			if (!(px >= 0 && px <= density->width &&
+					py >= 0 && py <= density->height))
+				continue;
+			if (py == density->height && !density->closed_bottom)
+				continue;
+			if (px >= density->width)
+				px = density->width - 1;
+			if (py >= density->height)
+				py = density->height - 1;
+
+			job->counts[(size_t)py * density->width +
+				(size_t)px]++;
+		}
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Bin all the points of the chart into the grid. The series is split in as
+ * many ranges as there are threads, each thread counts into its own grid and
+ * the grids are summed at the end. A data source can only be read once from
+ * start to end, it is binned on the calling thread.
+ */
+void
+chq_density_bin(chq_density_t *density, chq_dataplot_t *chart)
+{
+	chq_density_job_t *jobs;
+	pthread_t *threads;
+	size_t cells = (size_t)density->width * density->height;
+	size_t i, t, n_threads, per_thread;
+	long cpus;
+
+	density->max_count = 0;
+	if (cells == 0)
+		return;
+
+	CHQ_TRACE_BEGIN("density_bin", NULL);
+
+	n_threads = chart->threads;
+	if (n_threads == 0) {
+		cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n_threads = cpus > 0 ? cpus : 1;
+	}
+	if (chart->data_source != NULL)
+		n_threads = 1;
+	if (n_threads > chart->data_len / DENSITY_MIN_POINTS_PER_THREAD)
+		n_threads = chart->data_len / DENSITY_MIN_POINTS_PER_THREAD;
+	if (n_threads < 1)
+		n_threads = 1;
+
+	jobs = calloc(n_threads, sizeof(chq_density_job_t));
+	threads = calloc(n_threads, sizeof(pthread_t));
+	per_thread = (chart->data_len + n_threads - 1) / n_threads;
+
+	for (t = 0; t < n_threads; t++) {
+		jobs[t].chart = chart;
+		jobs[t].density = density;
+		chq_dataplot_cursor_init(chart, &jobs[t].cursor);
+		jobs[t].cursor.pos = t * per_thread;
+		if (jobs[t].cursor.pos > chart->data_len)
+			jobs[t].cursor.pos = chart->data_len;
+		if (jobs[t].cursor.pos + per_thread < chart->data_len)
+			jobs[t].cursor.end = jobs[t].cursor.pos + per_thread;
+
+		/* The first job counts straight into the final grid */
+		if (t == 0) {
+			jobs[t].counts = density->counts;
+		} else {
+			jobs[t].counts = calloc(cells, sizeof(uint32_t));
+		}
+	}
+
+	/* Run the first job on this thread, fall back to it on failure */
+	for (t = 1; t < n_threads; t++) {
+		if (pthread_create(&threads[t], NULL, chq_density_bin_job,
+					&jobs[t]) == 0)
+			jobs[t].spawned = 1;
+		else
+			chq_density_bin_job(&jobs[t]);
+	}
+	chq_density_bin_job(&jobs[0]);
+
+	for (t = 1; t < n_threads; t++) {
+		if (jobs[t].spawned)
+			pthread_join(threads[t], NULL);
+		for (i = 0; i < cells; i++)
+			density->counts[i] += jobs[t].counts[i];
+		free(jobs[t].counts);
+	}
+
+	density->max_count = 0;
+	for (i = 0; i < cells; i++) {
+		if (density->counts[i] > density->max_count)
+			density->max_count = density->counts[i];
+	}
+
+	free(threads);
+	free(jobs);
+
+	CHQ_TRACE_END("density_bin");
+}
+
+
+/**
+ * Color-map the counts straight into the pixels of the raster, empty cells
+ * are left untouched. Only the rows the raster covers are written.
+ */
+void
+chq_density_blit(chq_density_t *density, chq_raster_t *raster,
+		enum chq_density_scale scale)
+{
+	uint32_t ramp[256];
+	uint32_t *row, count;
+	unsigned int x, y, y_start, y_end;
+	double ratio, log_max;
+	int idx;
+
+	if (density->max_count == 0)
+		return;
+
+	CHQ_TRACE_BEGIN("density_blit", NULL);
+
+	for (idx = 0; idx < 256; idx++) {
+		ratio = idx / 255.0;
+		ramp[idx] = 0xff000000 |
+			(uint32_t)(255 * (DENSITY_LOW_R + ratio *
+				(DENSITY_HIGH_R - DENSITY_LOW_R))) << 16 |
+			(uint32_t)(255 * (DENSITY_LOW_G + ratio *
+				(DENSITY_HIGH_G - DENSITY_LOW_G))) << 8 |
+			(uint32_t)(255 * (DENSITY_LOW_B + ratio *
+				(DENSITY_HIGH_B - DENSITY_LOW_B)));
+	}
+
+	log_max = log1p(density->max_count);
+
+	/* Grid rows overlapping the raster */
+	idx = raster->y_offset - density->top;
+	y_start = idx > 0 ? idx : 0;
+	idx = raster->y_offset + raster->height - density->top;
+	y_end = idx > 0 ? idx : 0;
+	if (y_end > density->height)
+		y_end = density->height;
+
+	for (y = y_start; y < y_end; y++) {
+		row = (uint32_t *)(raster->data + (size_t)(density->top + y -
+					raster->y_offset) * raster->stride) +
+			density->left;
+		for (x = 0; x < density->width; x++) {
+			count = density->counts[(size_t)y * density->width + x];
+			if (count == 0)
+				continue;
+
+			switch (scale) {
+			case CHQ_DENSITY_LOG:
+				ratio = log1p(count) / log_max;
+				break;
+			case CHQ_DENSITY_LINEAR:
+			default:
+				ratio = (double)count / density->max_count;
+				break;
+			}
+
+			row[x] = ramp[(int)(ratio * 255.0)];
+		}
+	}
+
+	CHQ_TRACE_END("density_blit");
+}
+
+
+/**
+ * Draw the series of the chart as a density map: one pass over the data to
+ * count the points per pixel, one pass over the pixels to color them.
+ */
+void
+chq_dataplot_render_density(chq_dataplot_t *chart)
+{
+	chq_density_t *density = chq_density_new(chart, 0, chart->height);
+	chq_raster_t raster;
+
+	chq_density_bin(density, chart);
+
+	chq_raster_init(&raster, chart->surface, chart->surface_top);
+	chq_density_blit(density, &raster, chart->density_scale);
+	chq_raster_finish(&raster, chart->surface);
+
+	chq_density_kill(density);
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2010, Bertrand Janin <tamentis@neopulsar.org>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cairo.h>
+
+#include "chartesque.h"
+
+
+/**
+ * Used by cairo to save to file.
+ * @private
+ */
+static cairo_status_t
+stdio_write (void *closure, const unsigned char *data, unsigned int length)
+{
+	FILE *file = closure;
+
+	if (fwrite (data, 1, length, file) == length) {
+		return CAIRO_STATUS_SUCCESS;
+	} else {
+		return CAIRO_STATUS_WRITE_ERROR;
+	}
+}
+
+
+/**
+ * Encode the surface as PNG to the given file. Failing to open, write or
+ * close the file is reported as CAIRO_STATUS_WRITE_ERROR.
+ */
+cairo_status_t
+chq_output_write_png(cairo_surface_t *surface, const char *filename)
+{
+	cairo_status_t status;
+	FILE *fp;
+
+	CHQ_TRACE_BEGIN("write_png", filename);
+
+	fp = fopen(filename, "w");
+	if (fp == NULL) {
+		CHQ_TRACE_END("write_png");
+		return CAIRO_STATUS_WRITE_ERROR;
+	}
+
+	status = cairo_surface_write_to_png_stream(surface, stdio_write, fp);
+
+	if (fclose(fp) != 0 && status == CAIRO_STATUS_SUCCESS)
+		status = CAIRO_STATUS_WRITE_ERROR;
+
+	CHQ_TRACE_END("write_png");
+
+	return status;
+}
+
+
+/**
+ * Writer thread, pops the jobs in order until the queue is stopped and
+ * empty.
+ * @private
+ */
+static void *
+chq_output_queue_run(void *arg)
+{
+	chq_output_queue_t *queue = arg;
+	chq_output_job_t job;
+	cairo_status_t status;
+
+	pthread_mutex_lock(&queue->lock);
+	for (;;) {
+		while (queue->count == 0 && !queue->stopping)
+			pthread_cond_wait(&queue->not_empty, &queue->lock);
+		if (queue->count == 0)
+			break;
+
+		job = queue->jobs[queue->head];
+		queue->head = (queue->head + 1) % queue->capacity;
+		queue->count--;
+		queue->busy = 1;
+		pthread_cond_signal(&queue->not_full);
+		pthread_mutex_unlock(&queue->lock);
+
+		status = chq_output_write_png(job.surface, job.filename);
+		if (job.callback != NULL)
+			job.callback(job.filename, status, job.callback_data);
+		cairo_surface_destroy(job.surface);
+		free(job.filename);
+
+		pthread_mutex_lock(&queue->lock);
+		queue->busy = 0;
+		if (queue->count == 0)
+			pthread_cond_broadcast(&queue->drained);
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return NULL;
+}
+
+
+/**
+ * Constructor for an output queue holding at most capacity charts waiting
+ * to be written, it starts its writer thread. Returns NULL if the thread
+ * could not be started.
+ */
+chq_output_queue_t *
+chq_output_queue_new(unsigned int capacity)
+{
+	chq_output_queue_t *queue = malloc(sizeof(chq_output_queue_t));
+
+	if (capacity < 1)
+		capacity = 1;
+
+	queue->jobs = calloc(capacity, sizeof(chq_output_job_t));
+	queue->capacity = capacity;
+	queue->head = 0;
+	queue->count = 0;
+	queue->busy = 0;
+	queue->stopping = 0;
+
+	pthread_mutex_init(&queue->lock, NULL);
+	pthread_cond_init(&queue->not_empty, NULL);
+	pthread_cond_init(&queue->not_full, NULL);
+	pthread_cond_init(&queue->drained, NULL);
+
+	if (pthread_create(&queue->thread, NULL, chq_output_queue_run,
+				queue) != 0) {
+		pthread_cond_destroy(&queue->drained);
+		pthread_cond_destroy(&queue->not_full);
+		pthread_cond_destroy(&queue->not_empty);
+		pthread_mutex_destroy(&queue->lock);
+		free(queue->jobs);
+		free(queue);
+		return NULL;
+	}
+
+	return queue;
+}
+
+
+/**
+ * Destructor for an output queue, all the pending charts are written first.
+ */
+void
+chq_output_queue_kill(chq_output_queue_t *queue)
+{
+	pthread_mutex_lock(&queue->lock);
+	queue->stopping = 1;
+	pthread_cond_signal(&queue->not_empty);
+	pthread_mutex_unlock(&queue->lock);
+
+	pthread_join(queue->thread, NULL);
+
+	pthread_cond_destroy(&queue->drained);
+	pthread_cond_destroy(&queue->not_full);
+	pthread_cond_destroy(&queue->not_empty);
+	pthread_mutex_destroy(&queue->lock);
+	free(queue->jobs);
+	free(queue);
+}
+
+
+/**
+ * Hand a rendered surface over to the writer thread, the queue takes the
+ * ownership of the surface and copies the filename. Blocks while the queue
+ * is full so the renderers can't get ahead of the disk by more than the
+ * capacity.
+ */
+void
+chq_output_queue_push(chq_output_queue_t *queue, cairo_surface_t *surface,
+		const char *filename, chq_output_callback_t callback, void *data)
+{
+	chq_output_job_t *job;
+
+	pthread_mutex_lock(&queue->lock);
+	while (queue->count == queue->capacity)
+		pthread_cond_wait(&queue->not_full, &queue->lock);
+
+	job = &queue->jobs[(queue->head + queue->count) % queue->capacity];
+	job->surface = surface;
+	job->filename = strdup(filename);
+	job->callback = callback;
+	job->callback_data = data;
+	queue->count++;
+
+	pthread_cond_signal(&queue->not_empty);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+
+/**
+ * Block until every chart pushed so far has been written.
+ */
+void
+chq_output_queue_wait(chq_output_queue_t *queue)
+{
+	pthread_mutex_lock(&queue->lock);
+	while (queue->count > 0 || queue->busy)
+		pthread_cond_wait(&queue->drained, &queue->lock);
+	pthread_mutex_unlock(&queue->lock);
+}
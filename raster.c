@@ -0,0 +1,329 @@
+/*
+ * Copyright (c) 2010, Bertrand Janin <tamentis@neopulsar.org>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <cairo.h>
+
+#include "chartesque.h"
+
+
+/**
+ * Point the raster to the pixels of an ARGB32 image surface. Any pending
+ * cairo drawing is flushed first, y_offset is the canvas row of the first
+ * row of the surface.
+ */
+void
+chq_raster_init(chq_raster_t *raster, cairo_surface_t *surface, int y_offset)
+{
+	cairo_surface_flush(surface);
+	raster->data = cairo_image_surface_get_data(surface);
+	raster->width = cairo_image_surface_get_width(surface);
+	raster->height = cairo_image_surface_get_height(surface);
+	raster->stride = cairo_image_surface_get_stride(surface);
+	raster->y_offset = y_offset;
+}
+
+
+/**
+ * Let cairo know the pixels were modified behind its back.
+ */
+void
+chq_raster_finish(chq_raster_t *raster, cairo_surface_t *surface)
+{
+	cairo_surface_mark_dirty(surface);
+}
+
+
+/**
+ * Return an opaque premultiplied ARGB32 pixel from cairo-like components.
+ */
+uint32_t
+chq_raster_rgb(double r, double g, double b)
+{
+	return 0xff000000 |
+		(uint32_t)(r * 255.0 + 0.5) << 16 |
+		(uint32_t)(g * 255.0 + 0.5) << 8 |
+		(uint32_t)(b * 255.0 + 0.5);
+}
+
+
+/**
+ * Composite a premultiplied color over the pixel at the canvas position x, y
+ * with the given coverage (0.0 to 1.0). Pixels outside are ignored.
+ */
+void
+chq_raster_blend(chq_raster_t *raster, int x, int y, uint32_t color,
+		double coverage)
+{
+	uint32_t *pixel, dst, out, sa, inv, a, s, d;
+	int row = y - raster->y_offset;
+	int shift;
+
+	if (x < 0 || x >= raster->width || row < 0 || row >= raster->height ||
+			!(coverage > 0.0))
+		return;
+
+	pixel = (uint32_t *)(raster->data + (size_t)row * raster->stride) + x;
+
+	if (coverage >= 1.0 && (color >> 24) == 0xff) {
+		*pixel = color;
+		return;
+	}
+
+	if (coverage > 1.0)
+		coverage = 1.0;
+
+	a = (uint32_t)(coverage * 255.0 + 0.5);
+	sa = ((color >> 24) * a + 127) / 255;
+	inv = 255 - sa;
+	dst = *pixel;
+	out = 0;
+
+	for (shift = 0; shift < 32; shift += 8) {
+		s = (((color >> shift) & 0xff) * a + 127) / 255;
+		d = (dst >> shift) & 0xff;
+		out |= (s + (d * inv + 127) / 255) << shift;
+	}
+
+	*pixel = out;
+}
+
+
+/**
+ * Convert a canvas coordinate to an integer clamped to [min, max], done in
+ * double since coordinates far outside the surface do not fit an int. NaN
+ * gives min.
+ * @private
+ */
+static int
+chq_raster_clamp(double value, int min, int max)
+{
+	if (!(value > min))
+		return min;
+	if (value > max)
+		return max;
+	return (int)value;
+}
+
+
+/**
+ * Fill the area between the segment and the horizontal baseline, one
+ * vertical span per pixel column. Columns are sampled at their center and
+ * half-open on the right so consecutive segments never cover a column
+ * twice. The end of each span is antialiased.
+ */
+void
+chq_raster_fill_under(chq_raster_t *raster, double x0, double y0, double x1,
+		double y1, double base, uint32_t color)
+{
+	double slope, edge, lo, hi, y_min, y_max;
+	int px, px_end, row, row_lo, row_hi;
+	uint32_t *pixel;
+
+	if (x0 > x1) {
+		edge = x0; x0 = x1; x1 = edge;
+		edge = y0; y0 = y1; y1 = edge;
+	}
+	if (!(x1 > x0))
+		return;
+
+	slope = (y1 - y0) / (x1 - x0);
+	px = chq_raster_clamp(ceil(x0 - 0.5), 0, raster->width);
+	px_end = chq_raster_clamp(ceil(x1 - 0.5), 0, raster->width);
+
+	y_min = raster->y_offset;
+	y_max = raster->y_offset + raster->height;
+
+	for (; px < px_end; px++) {
+		edge = y0 + (px + 0.5 - x0) * slope;
+		lo = edge < base ? edge : base;
+		hi = edge < base ? base : edge;
+		if (lo < y_min)
+			lo = y_min;
+		if (hi > y_max)
+			hi = y_max;
+		if (!(hi > lo))
+			continue;
+
+		row_lo = (int)floor(lo);
+		row_hi = (int)floor(hi);
+		if (row_lo == row_hi) {
+			chq_raster_blend(raster, px, row_lo, color, hi - lo);
+			continue;
+		}
+
+		chq_raster_blend(raster, px, row_lo, color, row_lo + 1 - lo);
+		for (row = row_lo + 1; row < row_hi; row++) {
+			pixel = (uint32_t *)(raster->data + (size_t)(row -
+						raster->y_offset) *
+					raster->stride) + px;
+			*pixel = color;
+		}
+		chq_raster_blend(raster, px, row_hi, color, hi - row_hi);
+	}
+}
+
+
+/**
+ * Plot with the axes optionally swapped, used by the line drawing.
+ * @private
+ */
+static void
+chq_raster_plot(chq_raster_t *raster, int steep, int major, int minor,
+		uint32_t color, double coverage)
+{
+	if (steep)
+		chq_raster_blend(raster, minor, major, color, coverage);
+	else
+		chq_raster_blend(raster, major, minor, color, coverage);
+}
+
+
+/**
+ * Draw an antialiased line of the given width, Wu-style: the line is walked
+ * one pixel at a time along its major axis and every pixel crossed along
+ * the minor axis gets the exact fraction it overlaps with the line.
+ */
+void
+chq_raster_line(chq_raster_t *raster, double x0, double y0, double x1,
+		double y1, double width, uint32_t color)
+{
+	double tmp, slope, half, from, to, center, lo, hi, major_cov;
+	int steep, major, major_end, minor, minor_end;
+	int major_min, major_max, minor_min, minor_max;
+
+	steep = fabs(y1 - y0) > fabs(x1 - x0);
+	if (steep) {
+		tmp = x0; x0 = y0; y0 = tmp;
+		tmp = x1; x1 = y1; y1 = tmp;
+	}
+	if (x0 > x1) {
+		tmp = x0; x0 = x1; x1 = tmp;
+		tmp = y0; y0 = y1; y1 = tmp;
+	}
+	if (!(x1 > x0))
+		return;
+
+	slope = (y1 - y0) / (x1 - x0);
+	half = width / 2.0 * sqrt(1.0 + slope * slope);
+
+	if (steep) {
+		major_min = raster->y_offset;
+		major_max = raster->y_offset + raster->height - 1;
+		minor_min = 0;
+		minor_max = raster->width - 1;
+	} else {
+		major_min = 0;
+		major_max = raster->width - 1;
+		minor_min = raster->y_offset;
+		minor_max = raster->y_offset + raster->height - 1;
+	}
+
+	/* One past the bounds on the far side keeps empty ranges empty */
+	major = chq_raster_clamp(floor(x0), major_min, major_max + 1);
+	major_end = chq_raster_clamp(floor(x1), major_min - 1, major_max);
+
+	for (; major <= major_end; major++) {
+		from = x0 > major ? x0 : major;
+		to = x1 < major + 1 ? x1 : major + 1;
+		major_cov = to - from;
+		if (!(major_cov > 0.0))
+			continue;
+
+		center = y0 + ((from + to) / 2.0 - x0) * slope;
+		lo = center - half;
+		hi = center + half;
+
+		minor = chq_raster_clamp(floor(lo), minor_min, minor_max + 1);
+		minor_end = chq_raster_clamp(floor(hi), minor_min - 1,
+				minor_max);
+		for (; minor <= minor_end; minor++) {
+			from = lo > minor ? lo : minor;
+			to = hi < minor + 1 ? hi : minor + 1;
+			chq_raster_plot(raster, steep, major, minor, color,
+					(to - from) * major_cov);
+		}
+	}
+}
+
+
+/**
+ * Draw the series as a filled area straight into the pixels of the surface.
+ * The stroke of a chunk is drawn after the fill of the next one, so the fill
+ * never covers the edge of the previous segments.
+ */
+void
+chq_dataplot_render_plots_raster(chq_dataplot_t *chart)
+{
+	chq_raster_t raster;
+	chq_cursor_t cursor;
+	double buffers[2][2][CHQ_CHUNK_SIZE + 1];
+	double *cur_x, *cur_y, *prev_x, *prev_y, *swap;
+	double left, top, base;
+	size_t i, count, prev_len = 0;
+	uint32_t fill = chq_raster_rgb(0.4, 0.6, 1.0);
+	uint32_t stroke = chq_raster_rgb(0.2, 0.4, 0.7);
+
+	CHQ_TRACE_BEGIN("raster_plots", NULL);
+
+	chq_raster_init(&raster, chart->surface, chart->surface_top);
+	chq_dataplot_get_plot_origin(chart, &left, &top);
+
+	cur_x = buffers[0][0];
+	cur_y = buffers[0][1];
+	prev_x = buffers[1][0];
+	prev_y = buffers[1][1];
+
+	/* The area starts from the bottom-left corner of the plot */
+	base = top + chq_axis_convert_to_scale(chart->y_axis,
+			chart->y_axis->limit_min);
+	cur_x[0] = left + chq_axis_convert_to_scale(chart->x_axis,
+			chart->x_axis->limit_min);
+	cur_y[0] = base;
+
+	chq_dataplot_cursor_init(chart, &cursor);
+	while ((count = chq_dataplot_read_points(chart, &cursor, cur_x + 1,
+					cur_y + 1, CHQ_CHUNK_SIZE)) > 0) {
+		for (i = 1; i <= count; i++) {
+			chq_raster_fill_under(&raster, cur_x[i - 1],
+					cur_y[i - 1], cur_x[i], cur_y[i], base,
+					fill);
+		}
+		for (i = 1; i < prev_len; i++) {
+			chq_raster_line(&raster, prev_x[i - 1], prev_y[i - 1],
+					prev_x[i], prev_y[i], 2.0, stroke);
+		}
+
+		swap = prev_x; prev_x = cur_x; cur_x = swap;
+		swap = prev_y; prev_y = cur_y; cur_y = swap;
+		prev_len = count + 1;
+
+		/* The next chunk carries on from the last point */
+		cur_x[0] = prev_x[count];
+		cur_y[0] = prev_y[count];
+	}
+
+	for (i = 1; i < prev_len; i++) {
+		chq_raster_line(&raster, prev_x[i - 1], prev_y[i - 1],
+				prev_x[i], prev_y[i], 2.0, stroke);
+	}
+
+	chq_raster_finish(&raster, chart->surface);
+
+	CHQ_TRACE_END("raster_plots");
+}
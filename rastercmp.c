@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2010, Bertrand Janin <tamentis@neopulsar.org>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Draw the same series with the cairo and the raster backends and compare
+ * the plots pixel by pixel, printing how many pixels have a channel that
+ * differs by more than the tolerance (0 to 255). Exits with 1 if any does.
+ *
+ *     rastercmp [tolerance] [points]
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "chartesque.h"
+
+#define WIDTH	640
+#define HEIGHT	280
+
+
+static cairo_surface_t *
+draw_plots(chq_dataplot_t *chart, enum chq_plot_backend backend)
+{
+	cairo_surface_t *surface;
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, WIDTH,
+			HEIGHT);
+	chart->surface = surface;
+	chart->surface_top = 0;
+	chart->cr = cairo_create(surface);
+
+	chq_dataplot_layout_axes(chart);
+	if (backend == CHQ_BACKEND_RASTER)
+		chq_dataplot_render_plots_raster(chart);
+	else
+		chq_dataplot_render_plots(chart);
+
+	cairo_destroy(chart->cr);
+	cairo_surface_flush(surface);
+	chart->cr = NULL;
+	chart->surface = NULL;
+
+	return surface;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	chq_dataplot_t *chart;
+	cairo_surface_t *reference, *raster;
+	const uint32_t *ref_row, *ras_row;
+	unsigned char *ref_data, *ras_data;
+	double *data_x, *data_y;
+	size_t i, points = 1000, over = 0;
+	unsigned int x, y, shift, diff, max_diff = 0, tolerance = 64;
+	int stride, pixel_over;
+
+	if (argc > 1)
+		tolerance = strtoul(argv[1], NULL, 10);
+	if (argc > 2)
+		points = strtoul(argv[2], NULL, 10);
+	if (points < 2) {
+		fprintf(stderr, "usage: rastercmp [tolerance] [points]\n");
+		return 1;
+	}
+
+	data_x = malloc(points * sizeof(double));
+	data_y = malloc(points * sizeof(double));
+	for (i = 0; i < points; i++) {
+		data_x[i] = (double)i / (points - 1) * 100.0;
+		data_y[i] = 25.0 + 15.0 * sin(i * 0.05) + 5.0 * sin(i * 0.7);
+	}
+
+	chart = chq_dataplot_new();
+	chq_dataplot_set_width(chart, WIDTH);
+	chq_dataplot_set_height(chart, HEIGHT);
+	chq_dataplot_set_data(chart, data_x, data_y, points);
+	chq_axis_set_limit(chart->x_axis, 0, 100);
+	chq_axis_set_limit(chart->y_axis, 0, 50);
+
+	reference = draw_plots(chart, CHQ_BACKEND_CAIRO);
+	raster = draw_plots(chart, CHQ_BACKEND_RASTER);
+
+	ref_data = cairo_image_surface_get_data(reference);
+	ras_data = cairo_image_surface_get_data(raster);
+	stride = cairo_image_surface_get_stride(reference);
+
+	for (y = 0; y < HEIGHT; y++) {
+		ref_row = (const uint32_t *)(ref_data + (size_t)y * stride);
+		ras_row = (const uint32_t *)(ras_data + (size_t)y * stride);
+		for (x = 0; x < WIDTH; x++) {
+			pixel_over = 0;
+			for (shift = 0; shift < 32; shift += 8) {
+				diff = abs((int)((ref_row[x] >> shift) & 0xff) -
+						(int)((ras_row[x] >> shift) &
+						0xff));
+				if (diff > max_diff)
+					max_diff = diff;
+				if (diff > tolerance)
+					pixel_over = 1;
+			}
+			over += pixel_over;
+		}
+	}
+
+	printf("%zu points: %zu of %u pixels differ by more than %u "
+			"(max %u)\n", points, over, WIDTH * HEIGHT, tolerance,
+			max_diff);
+
+	cairo_surface_destroy(reference);
+	cairo_surface_destroy(raster);
+	chq_dataplot_kill(chart);
+	free(data_x);
+	free(data_y);
+
+	return over > 0;
+}
@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2010, Bertrand Janin <tamentis@neopulsar.org>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <cairo.h>
+
+#include "chartesque.h"
+
+/* Polling interval of consumers on systems without futexes. */
+#define SHM_POLL_NSEC	1000000
+
+
+/**
+ * Wake up everyone sleeping on the sequence, a no-op without futexes.
+ * @private
+ */
+static void
+chq_shm_wake(chq_shm_t *shm)
+{
+#ifdef __linux__
+	syscall(SYS_futex, &shm->header->sequence, FUTEX_WAKE, INT32_MAX,
+			NULL, NULL, 0);
+#endif
+}
+
+
+/**
+ * Sleep until the sequence is no longer the given value, or for a little
+ * while on systems without futexes.
+ * @private
+ */
+static void
+chq_shm_sleep(chq_shm_t *shm, uint32_t sequence)
+{
+#ifdef __linux__
+	syscall(SYS_futex, &shm->header->sequence, FUTEX_WAIT, sequence,
+			NULL, NULL, 0);
+#else
+	struct timespec ts = { 0, SHM_POLL_NSEC };
+
+	nanosleep(&ts, NULL);
+#endif
+}
+
+
+/**
+ * Map a shared-memory object and wrap it, returns NULL on failure.
+ * @private
+ */
+static chq_shm_t *
+chq_shm_map(const char *name, int fd, size_t size, int owner)
+{
+	chq_shm_t *shm;
+	void *addr;
+
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED)
+		return NULL;
+
+	shm = malloc(sizeof(chq_shm_t));
+	shm->name = strdup(name);
+	shm->fd = fd;
+	shm->owner = owner;
+	shm->size = size;
+	shm->header = addr;
+
+	return shm;
+}
+
+
+/**
+ * Create a shared-memory framebuffer for width x height charts, the name
+ * follows the shm_open() rules (e.g. "/wallboard"). Returns NULL on failure.
+ */
+chq_shm_t *
+chq_shm_create(const char *name, unsigned int width, unsigned int height)
+{
+	chq_shm_t *shm;
+	size_t page, header_size, frame_size;
+	int fd, stride;
+
+	stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, width);
+	if (stride < 0)
+		return NULL;
+
+	page = sysconf(_SC_PAGESIZE);
+	header_size = (sizeof(chq_shm_header_t) + page - 1) / page * page;
+	frame_size = ((size_t)stride * height + page - 1) / page * page;
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return NULL;
+
+	if (ftruncate(fd, header_size + frame_size * 2) != 0 ||
+			(shm = chq_shm_map(name, fd, header_size +
+				frame_size * 2, 1)) == NULL) {
+		close(fd);
+		shm_unlink(name);
+		return NULL;
+	}
+
+	shm->header->width = width;
+	shm->header->height = height;
+	shm->header->stride = stride;
+	shm->header->sequence = 0;
+	shm->header->front = 0;
+	shm->header->frame_offset[0] = header_size;
+	shm->header->frame_offset[1] = header_size + frame_size;
+	__atomic_store_n(&shm->header->magic, CHQ_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	return shm;
+}
+
+
+/**
+ * Return true if both frames described by the header lie within the
+ * mapping, so a stale or corrupt segment can't make us read past it.
+ * @private
+ */
+static int
+chq_shm_check_frames(chq_shm_t *shm)
+{
+	chq_shm_header_t *header = shm->header;
+	uint64_t frame_size = (uint64_t)header->stride * header->height;
+	int i;
+
+	if ((uint64_t)header->stride < (uint64_t)header->width * 4)
+		return 0;
+
+	for (i = 0; i < 2; i++) {
+		if (header->frame_offset[i] < sizeof(chq_shm_header_t) ||
+				header->frame_offset[i] > shm->size ||
+				frame_size > shm->size -
+				header->frame_offset[i])
+			return 0;
+	}
+
+	return 1;
+}
+
+
+/**
+ * Attach to a framebuffer created by another process. Returns NULL if it
+ * does not exist, is not a chartesque framebuffer or its frames don't fit
+ * in the segment.
+ */
+chq_shm_t *
+chq_shm_open(const char *name)
+{
+	struct stat st;
+	chq_shm_t *shm;
+	int fd;
+
+	fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) != 0 ||
+			(size_t)st.st_size < sizeof(chq_shm_header_t) ||
+			(shm = chq_shm_map(name, fd, st.st_size, 0)) == NULL) {
+		close(fd);
+		return NULL;
+	}
+
+	if (__atomic_load_n(&shm->header->magic, __ATOMIC_ACQUIRE) !=
+			CHQ_SHM_MAGIC || !chq_shm_check_frames(shm)) {
+		chq_shm_kill(shm);
+		return NULL;
+	}
+
+	return shm;
+}
+
+
+/**
+ * Destructor for a framebuffer, the creator also removes the name.
+ */
+void
+chq_shm_kill(chq_shm_t *shm)
+{
+	munmap(shm->header, shm->size);
+	close(shm->fd);
+	if (shm->owner)
+		shm_unlink(shm->name);
+	free(shm->name);
+	free(shm);
+}
+
+
+/**
+ * Return the pixels of one of the two frames.
+ */
+unsigned char *
+chq_shm_get_frame(chq_shm_t *shm, unsigned int idx)
+{
+	return (unsigned char *)shm->header + shm->header->frame_offset[idx];
+}
+
+
+/**
+ * Return a cairo surface over the back frame, the one consumers are not
+ * reading. It needs to be destroyed before chq_shm_publish().
+ */
+cairo_surface_t *
+chq_shm_get_back_surface(chq_shm_t *shm)
+{
+	unsigned int back = !__atomic_load_n(&shm->header->front,
+			__ATOMIC_ACQUIRE);
+
+	return cairo_image_surface_create_for_data(chq_shm_get_frame(shm, back),
+			CAIRO_FORMAT_ARGB32, shm->header->width,
+			shm->header->height, shm->header->stride);
+}
+
+
+/**
+ * Make the back frame the front one and wake up the consumers.
+ */
+void
+chq_shm_publish(chq_shm_t *shm)
+{
+	unsigned int back = !__atomic_load_n(&shm->header->front,
+			__ATOMIC_ACQUIRE);
+
+	CHQ_TRACE_BEGIN("shm_publish", shm->name);
+	__atomic_store_n(&shm->header->front, back, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&shm->header->sequence, 1, __ATOMIC_RELEASE);
+	/*
+	 * The release above only orders the drawing done before it, the next
+	 * render draws into the old front frame right after: keep those
+	 * writes from becoming visible before the new sequence.
+	 */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	chq_shm_wake(shm);
+	CHQ_TRACE_END("shm_publish");
+}
+
+
+/**
+ * Block until a frame newer than the given sequence was published, returns
+ * the current sequence.
+ */
+uint32_t
+chq_shm_wait(chq_shm_t *shm, uint32_t sequence)
+{
+	uint32_t current;
+
+	while ((current = __atomic_load_n(&shm->header->sequence,
+					__ATOMIC_ACQUIRE)) == sequence)
+		chq_shm_sleep(shm, sequence);
+
+	return current;
+}
+
+
+/**
+ * Copy the latest complete frame to dst (stride * height bytes) and return
+ * its sequence. The producer may start drawing over the frame being copied
+ * as soon as it publishes the next one, so the copy is retried until no
+ * frame was published while it was being made.
+ */
+uint32_t
+chq_shm_read(chq_shm_t *shm, unsigned char *dst)
+{
+	uint32_t before, after;
+	unsigned int front;
+
+	do {
+		before = __atomic_load_n(&shm->header->sequence,
+				__ATOMIC_ACQUIRE);
+		front = __atomic_load_n(&shm->header->front,
+				__ATOMIC_ACQUIRE);
+		memcpy(dst, chq_shm_get_frame(shm, front),
+				(size_t)shm->header->stride *
+				shm->header->height);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		after = __atomic_load_n(&shm->header->sequence,
+				__ATOMIC_RELAXED);
+	} while (before != after);
+
+	return after;
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2010, Bertrand Janin <tamentis@neopulsar.org>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Minimal consumer of a chartesque shared-memory framebuffer, it waits for
+ * every new frame, copies it and prints its sequence and a checksum. With a
+ * filename, the last frame is also saved as a PPM image (over white).
+ *
+ *     shmview /name [frames] [last.ppm]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "chartesque.h"
+
+
+static void
+write_ppm(const char *filename, const unsigned char *data, unsigned int width,
+		unsigned int height, unsigned int stride)
+{
+	const uint32_t *row;
+	unsigned int x, y;
+	uint32_t pixel, inv;
+	FILE *fp;
+
+	fp = fopen(filename, "wb");
+	if (fp == NULL) {
+		perror(filename);
+		return;
+	}
+
+	fprintf(fp, "P6\n%u %u\n255\n", width, height);
+	for (y = 0; y < height; y++) {
+		row = (const uint32_t *)(data + (size_t)y * stride);
+		for (x = 0; x < width; x++) {
+			pixel = row[x];
+			inv = 255 - (pixel >> 24);
+			fputc(((pixel >> 16) & 0xff) + inv, fp);
+			fputc(((pixel >> 8) & 0xff) + inv, fp);
+			fputc((pixel & 0xff) + inv, fp);
+		}
+	}
+
+	fclose(fp);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	chq_shm_t *shm;
+	unsigned char *frame;
+	uint32_t sequence, checksum;
+	size_t i, size;
+	long frames = -1;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: shmview /name [frames] [last.ppm]\n");
+		return 1;
+	}
+	if (argc > 2)
+		frames = strtol(argv[2], NULL, 10);
+
+	shm = chq_shm_open(argv[1]);
+	if (shm == NULL) {
+		fprintf(stderr, "shmview: can't open framebuffer %s\n",
+				argv[1]);
+		return 1;
+	}
+
+	size = (size_t)shm->header->stride * shm->header->height;
+	frame = malloc(size);
+	sequence = 0;
+
+	while (frames != 0) {
+		sequence = chq_shm_wait(shm, sequence);
+		sequence = chq_shm_read(shm, frame);
+
+		checksum = 0;
+		for (i = 0; i < size; i++)
+			checksum = checksum * 31 + frame[i];
+
+		printf("frame %u: %ux%u checksum %08x\n", sequence,
+				shm->header->width, shm->header->height,
+				checksum);
+		fflush(stdout);
+
+		if (frames > 0)
+			frames--;
+	}
+
+	if (argc > 3)
+		write_ppm(argv[3], frame, shm->header->width,
+				shm->header->height, shm->header->stride);
+
+	free(frame);
+	chq_shm_kill(shm);
+
+	return 0;
+}
@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2010, Bertrand Janin <tamentis@neopulsar.org>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <cairo.h>
+#include <png.h>
+
+#include "chartesque.h"
+
+struct _chq_png_writer_t {
+	FILE		*fp;
+	png_structp	 png;
+	png_infop	 info;
+	unsigned int	 width;
+	unsigned char	*row;
+};
+
+
+/**
+ * Constructor for a PNG writer, the header is written right away. Returns
+ * NULL if the file can't be opened or libpng fails.
+ */
+chq_png_writer_t *
+chq_png_writer_open(const char *filename, unsigned int width,
+		unsigned int height)
+{
+	chq_png_writer_t *writer = calloc(1, sizeof(chq_png_writer_t));
+
+	writer->width = width;
+	writer->row = malloc((size_t)width * 4);
+
+	writer->fp = fopen(filename, "wb");
+	if (writer->fp == NULL)
+		goto fail;
+
+	writer->png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL,
+			NULL, NULL);
+	if (writer->png == NULL)
+		goto fail;
+
+	writer->info = png_create_info_struct(writer->png);
+	if (writer->info == NULL)
+		goto fail;
+
+	if (setjmp(png_jmpbuf(writer->png)))
+		goto fail;
+
+	png_init_io(writer->png, writer->fp);
+	png_set_IHDR(writer->png, writer->info, width, height, 8,
+			PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
+			PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(writer->png, writer->info);
+
+	return writer;
+
+fail:
+	if (writer->png != NULL)
+		png_destroy_write_struct(&writer->png, &writer->info);
+	if (writer->fp != NULL)
+		fclose(writer->fp);
+	free(writer->row);
+	free(writer);
+	return NULL;
+}
+
+
+/**
+ * Encode rows of premultiplied ARGB32 pixels, as found in a cairo image
+ * surface, converting them to straight RGBA on the way.
+ */
+cairo_status_t
+chq_png_writer_write_rows(chq_png_writer_t *writer, const unsigned char *data,
+		int stride, unsigned int rows)
+{
+	const uint32_t *pixels;
+	unsigned char *out;
+	unsigned int x, y;
+	uint32_t pixel, alpha;
+
+	if (setjmp(png_jmpbuf(writer->png))) {
+		CHQ_TRACE_END("write_rows");
+		return CAIRO_STATUS_WRITE_ERROR;
+	}
+
+	CHQ_TRACE_BEGIN("write_rows", NULL);
+
+	for (y = 0; y < rows; y++) {
+		pixels = (const uint32_t *)(data + (size_t)y * stride);
+		out = writer->row;
+
+		for (x = 0; x < writer->width; x++, out += 4) {
+			pixel = pixels[x];
+			alpha = pixel >> 24;
+			if (alpha == 0) {
+				out[0] = out[1] = out[2] = out[3] = 0;
+				continue;
+			}
+			out[0] = (((pixel >> 16) & 0xff) * 255 + alpha / 2) /
+				alpha;
+			out[1] = (((pixel >> 8) & 0xff) * 255 + alpha / 2) /
+				alpha;
+			out[2] = ((pixel & 0xff) * 255 + alpha / 2) / alpha;
+			out[3] = alpha;
+		}
+
+		png_write_row(writer->png, writer->row);
+	}
+
+	CHQ_TRACE_END("write_rows");
+
+	return CAIRO_STATUS_SUCCESS;
+}
+
+
+/**
+ * Finish the PNG stream and destroy the writer, reports any error that
+ * occurred while flushing or closing the file.
+ */
+cairo_status_t
+chq_png_writer_close(chq_png_writer_t *writer)
+{
+	cairo_status_t status = CAIRO_STATUS_SUCCESS;
+
+	if (setjmp(png_jmpbuf(writer->png))) {
+		status = CAIRO_STATUS_WRITE_ERROR;
+	} else {
+		png_write_end(writer->png, writer->info);
+	}
+
+	png_destroy_write_struct(&writer->png, &writer->info);
+	if (fclose(writer->fp) != 0)
+		status = CAIRO_STATUS_WRITE_ERROR;
+	free(writer->row);
+	free(writer);
+
+	return status;
+}
+
+
+/**
+ * Highest count of the density map over the whole chart, found by binning
+ * one strip at a time so the grid never grows past a strip.
+ * @private
+ */
+static uint32_t
+chq_dataplot_strips_max_count(chq_dataplot_t *chart)
+{
+	chq_density_t *density;
+	uint32_t max_count = 0;
+	unsigned int top;
+
+	for (top = 0; top < chart->height; top += chart->strip_height) {
+		density = chq_density_new(chart, top, chart->strip_height);
+		chq_density_bin(density, chart);
+		if (density->max_count > max_count)
+			max_count = density->max_count;
+		chq_density_kill(density);
+	}
+
+	return max_count;
+}
+
+
+/**
+ * Render the chart strip_height rows at a time into a single small surface,
+ * each strip being encoded before the next one is drawn. The axes are laid
+ * out once, then every strip is drawn with the canvas translated and clipped
+ * to the strip. In density mode each strip is binned into a grid of its own
+ * rows, after a first pass over all the strips to find the highest count the
+ * colors are scaled to, so the series is read twice per strip.
+ */
+cairo_status_t
+chq_dataplot_render_strips(chq_dataplot_t *chart)
+{
+	chq_png_writer_t *writer;
+	chq_density_t *density;
+	chq_raster_t raster;
+	uint32_t max_count = 0;
+	cairo_status_t status = CAIRO_STATUS_SUCCESS;
+	unsigned int top, rows;
+
+	chart->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+			chart->width, chart->strip_height);
+	chart->cr = cairo_create(chart->surface);
+	chart->surface_top = 0;
+
+	writer = chq_png_writer_open(chart->output_filename, chart->width,
+			chart->height);
+	if (writer == NULL) {
+		status = CAIRO_STATUS_WRITE_ERROR;
+		goto done;
+	}
+
+	chq_dataplot_layout_axes(chart);
+
+	if (chart->plot_mode == CHQ_PLOT_DENSITY)
+		max_count = chq_dataplot_strips_max_count(chart);
+
+	for (top = 0; top < chart->height; top += chart->strip_height) {
+		rows = chart->height - top;
+		if (rows > chart->strip_height)
+			rows = chart->strip_height;
+		chart->surface_top = top;
+
+		CHQ_TRACE_BEGIN("draw_strip", NULL);
+
+		cairo_save(chart->cr);
+		cairo_set_operator(chart->cr, CAIRO_OPERATOR_CLEAR);
+		cairo_paint(chart->cr);
+		cairo_restore(chart->cr);
+
+		cairo_save(chart->cr);
+		cairo_rectangle(chart->cr, 0, 0, chart->width, rows);
+		cairo_clip(chart->cr);
+		cairo_translate(chart->cr, 0, -(double)top);
+
+		chq_dataplot_draw_axes(chart);
+
+		if (chart->plot_mode == CHQ_PLOT_DENSITY) {
+			density = chq_density_new(chart, top, rows);
+			chq_density_bin(density, chart);
+			density->max_count = max_count;
+			chq_raster_init(&raster, chart->surface, top);
+			raster.height = rows;
+			chq_density_blit(density, &raster,
+					chart->density_scale);
+			chq_raster_finish(&raster, chart->surface);
+			chq_density_kill(density);
+		} else if (chart->backend == CHQ_BACKEND_RASTER) {
+			chq_dataplot_render_plots_raster(chart);
+		} else {
+			chq_dataplot_render_plots(chart);
+		}
+
+		cairo_restore(chart->cr);
+		cairo_surface_flush(chart->surface);
+
+		CHQ_TRACE_END("draw_strip");
+
+		status = chq_png_writer_write_rows(writer,
+				cairo_image_surface_get_data(chart->surface),
+				cairo_image_surface_get_stride(chart->surface),
+				rows);
+		if (status != CAIRO_STATUS_SUCCESS)
+			break;
+	}
+
+	if (chq_png_writer_close(writer) != CAIRO_STATUS_SUCCESS)
+		status = CAIRO_STATUS_WRITE_ERROR;
+
+done:
+	if (chart->output_callback != NULL)
+		chart->output_callback(chart->output_filename, status,
+				chart->output_callback_data);
+
+	cairo_destroy(chart->cr);
+	cairo_surface_destroy(chart->surface);
+	chart->cr = NULL;
+	chart->surface = NULL;
+	chart->surface_top = 0;
+
+	return status;
+}
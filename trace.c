@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2010, Bertrand Janin <tamentis@neopulsar.org>
+ * 
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <cairo.h>
+
+#include "chartesque.h"
+
+static pthread_mutex_t	 trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE		*trace_fp = NULL;
+static int		 trace_events = 0;
+
+
+/**
+ * Start writing the trace events to a file, in the Chrome trace-event JSON
+ * format (chrome://tracing, Perfetto). Returns -1 if the file can't be
+ * opened. Only builds with CHQ_TRACE emit events.
+ */
+int
+chq_trace_open(const char *filename)
+{
+	FILE *fp = fopen(filename, "w");
+
+	if (fp == NULL)
+		return -1;
+
+	chq_trace_close();
+
+	pthread_mutex_lock(&trace_lock);
+	fputs("[\n", fp);
+	trace_events = 0;
+	__atomic_store_n(&trace_fp, fp, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&trace_lock);
+
+	return 0;
+}
+
+
+/**
+ * Terminate the JSON array and close the trace file, if any.
+ */
+void
+chq_trace_close(void)
+{
+	pthread_mutex_lock(&trace_lock);
+	if (trace_fp != NULL) {
+		fputs("\n]\n", trace_fp);
+		fclose(trace_fp);
+		__atomic_store_n(&trace_fp, NULL, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&trace_lock);
+}
+
+
+/**
+ * Write a JSON string, escaping what needs to be.
+ * @private
+ */
+static void
+chq_trace_write_string(FILE *fp, const char *s)
+{
+	fputc('"', fp);
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			fputc('\\', fp);
+		if ((unsigned char)*s < 0x20) {
+			fprintf(fp, "\\u%04x", *s);
+			continue;
+		}
+		fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+
+/**
+ * Record a begin ('B') or end ('E') event for the calling thread, detail is
+ * an optional string attached to the event (e.g. the output filename).
+ */
+void
+chq_trace_event(char phase, const char *name, const char *detail)
+{
+	struct timespec ts;
+	unsigned long tid;
+
+	if (__atomic_load_n(&trace_fp, __ATOMIC_ACQUIRE) == NULL)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#ifdef __linux__
+	tid = syscall(SYS_gettid);
+#else
+	tid = (unsigned long)pthread_self();
+#endif
+
+	pthread_mutex_lock(&trace_lock);
+	if (trace_fp == NULL) {
+		pthread_mutex_unlock(&trace_lock);
+		return;
+	}
+
+	fprintf(trace_fp, "%s{\"name\":\"%s\",\"cat\":\"chartesque\","
+			"\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%lu",
+			trace_events++ > 0 ? ",\n" : "", name, phase,
+			ts.tv_sec * 1e6 + ts.tv_nsec / 1e3, (int)getpid(),
+			tid);
+	if (detail != NULL) {
+		fputs(",\"args\":{\"detail\":", trace_fp);
+		chq_trace_write_string(trace_fp, detail);
+		fputc('}', trace_fp);
+	}
+	fputc('}', trace_fp);
+
+	pthread_mutex_unlock(&trace_lock);
+}